@@ -6,11 +6,15 @@
 #include <algorithm>
 #include <cmath>
 #include <vector>
+#include <sstream>
+#include <poll.h>
+#include <unistd.h>
 
 using namespace std;
 
 enum {
-	PACKET_START_LOCALIZATION = 1,
+	PACKET_JOIN_SESSION,
+	PACKET_START_LOCALIZATION,
 	PACKET_CHECK_SPEAKERS_ONLINE,
 	PACKET_CHECK_SOUND_IMAGE,
 	PACKET_CHECK_SOUND_IMAGE_WHITE,
@@ -18,12 +22,32 @@ enum {
 	PACKET_SET_EQ_STATUS,
 	PACKET_RESET_EVERYTHING,
 	PACKET_SET_SOUND_EFFECTS,
-	PACKET_TESTING
+	PACKET_TESTING,
+	PACKET_JOB_STARTED,
+	PACKET_JOB_PROGRESS,
+	PACKET_JOB_STATUS,
+	PACKET_JOB_CANCEL,
+	PACKET_SET_SETTING,
+	PACKET_VERIFY_SOUND_IMAGE
 };
 
+enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_CANCELLED,
+	JOB_FAILED
+};
+
+static const vector<string> g_job_states = { "queued", "running", "done", "cancelled", "failed" };
+
 enum {
 	WHITE_NOISE,
-	NINE_FREQ
+	NINE_FREQ,
+	MULTIPLE_SWEEPS,
+	SWEEP,
+	MAXIMUM_LENGTH_SEQUENCE,
+	MULTITONE
 };
 
 static NetworkCommunication* g_network;
@@ -47,6 +71,100 @@ static vector<string> g_ips = { /*"172.25.14.27", "172.25.9.27",*/ "172.25.12.16
 static vector<string> g_external_microphones = { "172.25.15.233"/*, "172.25.13.82", "172.25.10.134"*/ }; //, "172.25.13.82" };
 static vector<double> g_mic_gains = { -40 };
 
+Packet createJobPacket(unsigned char header, int id) {
+	Packet packet;
+	packet.addHeader(header);
+	packet.addInt(id);
+	packet.finalize();
+	return packet;
+}
+
+// What was typed while waiting for a job, empty if nothing was typed within timeout_ms
+static string readInput(int timeout_ms) {
+	pollfd input = { STDIN_FILENO, POLLIN, 0 };
+	
+	if (poll(&input, 1, timeout_ms) <= 0)
+		return "";
+	
+	char buffer[256];
+	auto size = read(STDIN_FILENO, buffer, sizeof(buffer));
+	
+	return size > 0 ? string(buffer, size) : "";
+}
+
+/*
+	Long requests are answered with a job ID right away, then progress packets follow until
+	either the reply (with the job ID after the header) or a status packet if the job didn't finish.
+	While waiting, entering c cancels the job and s asks for its status.
+	The returned packet is read up to the payload.
+*/
+Packet waitForJob(bool& completed) {
+	auto started = g_network->waitForIncomingPacket();
+	started.getByte();
+	int id = started.getInt();
+	
+	cout << "(job " << id << ", c to cancel, s for status)" << flush;
+	
+	while (true) {
+		auto* incoming = g_network->getIncomingPacket();
+		
+		if (incoming == nullptr) {
+			auto input = readInput(100);
+			
+			if (input.find('c') != string::npos)
+				g_network->pushOutgoingPacket(createJobPacket(PACKET_JOB_CANCEL, id));
+			else if (input.find('s') != string::npos)
+				g_network->pushOutgoingPacket(createJobPacket(PACKET_JOB_STATUS, id));
+			
+			continue;
+		}
+		
+		auto answer = *incoming;
+		g_network->popIncomingPacket();
+		
+		auto header = answer.getByte();
+		int job = answer.getInt();
+		
+		if (job != id)
+			continue;
+		
+		if (header == PACKET_JOB_PROGRESS) {
+			string stage = answer.getString();
+			string speaker = answer.getString();
+			double percent = answer.getFloat();
+			
+			cout << "\n\t" << lround(percent) << " %\t" << stage << (speaker.empty() ? "" : " (" + speaker + ")") << flush;
+			continue;
+		}
+		
+		if (header == PACKET_JOB_CANCEL) {
+			cout << "\n\t" << (answer.getBool() ? "cancelling" : "could not cancel") << flush;
+			continue;
+		}
+		
+		if (header == PACKET_JOB_STATUS) {
+			int state = answer.getInt();
+			string stage = answer.getString();
+			
+			// Asked for with s, the job goes on
+			if (state == JOB_QUEUED || state == JOB_RUNNING) {
+				cout << "\n\tjob " << id << " is " << g_job_states.at(state) << ", " << stage << flush;
+				continue;
+			}
+			
+			cout << "\nJob " << id << " " << g_job_states.at(state) << " while " << stage << endl;
+			
+			completed = false;
+			return answer;
+		}
+		
+		cout << endl;
+		
+		completed = true;
+		return answer;
+	}
+}
+
 Packet createStartSpeakerLocalization(const vector<string>& ips, bool force) {
 	Packet packet;
 	packet.addHeader(PACKET_START_LOCALIZATION);
@@ -78,15 +196,26 @@ void resetEverything() {
 	
 	cout << "Resetting...\t " << flush;
 	g_network->pushOutgoingPacket(createResetEverything(all_ips));
-	g_network->waitForIncomingPacket();
-	cout << "done\n\n";
+	
+	bool completed;
+	waitForJob(completed);
+	
+	if (completed)
+		cout << "done\n\n";
 }
 
 void startSpeakerLocalization(const vector<string>& ips, bool force) {
 	cout << "Running speaker localization script.. " << flush;
 	g_network->pushOutgoingPacket(createStartSpeakerLocalization(ips, force));
-	auto answer = g_network->waitForIncomingPacket();
-	answer.getByte();
+	
+	bool completed;
+	auto answer = waitForJob(completed);
+	
+	if (!completed) {
+		cout << endl;
+		return;
+	}
+	
 	cout << "done\n\n";
 	
 	// Parse data
@@ -146,10 +275,15 @@ void speakersOnline() {
 	
 	cout << "Trying speakers.. " << flush;
 	g_network->pushOutgoingPacket(createCheckSpeakerOnline(all_ips));
-	auto answer = g_network->waitForIncomingPacket();
+	
+	bool completed;
+	auto answer = waitForJob(completed);
+	
+	if (!completed)
+		return;
+	
 	cout << "done!\n\n";
 	
-	answer.getByte();
 	int num_speakers = answer.getInt();
 	
 	for (int i = 0; i < num_speakers; i++) {
@@ -167,9 +301,9 @@ void speakersOnline() {
 	cout << endl;
 }
 
-Packet createSoundImage(const vector<string>& speakers, const vector<string>& mics, const vector<double>& gains, bool factor_calibration, int type) {
+Packet createSoundImage(const vector<string>& speakers, const vector<string>& mics, const vector<double>& gains, bool factor_calibration, int type, unsigned char header = PACKET_CHECK_SOUND_IMAGE) {
 	Packet packet;
-	packet.addHeader(PACKET_CHECK_SOUND_IMAGE);
+	packet.addHeader(header);
 	packet.addBool(factor_calibration);
 	packet.addInt(type);
 	packet.addInt(speakers.size());
@@ -200,12 +334,27 @@ void soundImage(int type) {
 			
 		case NINE_FREQ: cout << "\n(9-freq)";
 			break;
+			
+		case MULTIPLE_SWEEPS: cout << "\n(Multiple sweeps)";
+			break;
+			
+		case SWEEP: cout << "\n(Sweep)";
+			break;
+			
+		case MAXIMUM_LENGTH_SEQUENCE: cout << "\n(MLS)";
+			break;
+			
+		case MULTITONE: cout << "\n(Multitone)";
+			break;
 	}
 	
 	cout << "\nRunning sound image correction...\t" << flush;
 	g_network->pushOutgoingPacket(createSoundImage(g_ips, g_external_microphones, g_mic_gains, answer == 'Y', type));
-	g_network->waitForIncomingPacket();
-	cout << "done\n\n";
+	
+	bool completed;
+	waitForJob(completed);
+	
+	cout << (completed ? "done\n\n" : "\n");
 }
 
 Packet createBestEQ(const vector<string>& speakers, const vector<string>& mics) {
@@ -248,8 +397,12 @@ Packet createSetEQStatus(const vector<string>& ips, bool status) {
 void setEQStatus(bool status) {
 	cout << (status ? "Enabling" : "Disabling") << " EQ in speakers... \t" << flush;
 	g_network->pushOutgoingPacket(createSetEQStatus(g_ips, status));
-	g_network->waitForIncomingPacket();
-	cout << "done\n\n";
+	
+	bool completed;
+	waitForJob(completed);
+	
+	if (completed)
+		cout << "done\n\n";
 }
 
 Packet createSetSoundEffects(const vector<string>& ips, bool status) {
@@ -268,8 +421,12 @@ Packet createSetSoundEffects(const vector<string>& ips, bool status) {
 void setSoundEffects(bool status) {
 	cout << (status ? "Enabling" : "Disabling") << " Axis sound effects... \t" << flush;
 	g_network->pushOutgoingPacket(createSetSoundEffects(g_ips, status));
-	g_network->waitForIncomingPacket();
-	cout << "done\n\n";
+	
+	bool completed;
+	waitForJob(completed);
+	
+	if (completed)
+		cout << "done\n\n";
 }
 
 Packet createTesting() {
@@ -282,8 +439,114 @@ Packet createTesting() {
 void testing() {
 	cout << "Running testing method in server.. \t" << flush;
 	g_network->pushOutgoingPacket(createTesting());
+	
+	bool completed;
+	waitForJob(completed);
+	
+	if (completed)
+		cout << "done\n\n";
+}
+
+// Jobs are shared by every client, e.g. cancel a calibration started from another terminal
+void jobStatus(bool cancel) {
+	int id;
+	cout << "Job ID: ";
+	cin >> id;
+	
+	if (cancel) {
+		g_network->pushOutgoingPacket(createJobPacket(PACKET_JOB_CANCEL, id));
+		auto answer = g_network->waitForIncomingPacket();
+		answer.getByte();
+		answer.getInt();
+		
+		cout << "Job " << id << (answer.getBool() ? " is being cancelled\n\n" : " is not running\n\n");
+		return;
+	}
+	
+	g_network->pushOutgoingPacket(createJobPacket(PACKET_JOB_STATUS, id));
+	auto answer = g_network->waitForIncomingPacket();
+	answer.getByte();
+	answer.getInt();
+	
+	int state = answer.getInt();
+	string stage = answer.getString();
+	string speaker = answer.getString();
+	double percent = answer.getFloat();
+	
+	cout << "Job " << id << " is " << g_job_states.at(state) << ", " << stage << (speaker.empty() ? "" : " (" + speaker + ")") << ", " << lround(percent) << " %\n\n";
+}
+
+Packet createSetSetting(const string& key, const vector<string>& values) {
+	Packet packet;
+	packet.addHeader(PACKET_SET_SETTING);
+	packet.addString(key);
+	packet.addInt(values.size());
+	
+	for (auto& value : values)
+		packet.addString(value);
+		
+	packet.finalize();
+	return packet;
+}
+
+// Reconnecting to the same session gets its speakers, placements and EQs back
+void joinSession() {
+	Packet packet;
+	packet.addHeader(PACKET_JOIN_SESSION);
+	packet.addString(g_config.get<string>("session"));
+	packet.finalize();
+	
+	g_network->pushOutgoingPacket(packet);
 	g_network->waitForIncomingPacket();
-	cout << "done\n\n";
+}
+
+// Overrides server config values for the session only, as key=value or key=value1,value2
+void setSessionSettings() {
+	for (auto& setting : g_config.getAll<string>("session_settings")) {
+		auto separator = setting.find('=');
+		
+		if (separator == string::npos) {
+			cout << "Warning: ignoring session setting " << setting << endl;
+			continue;
+		}
+		
+		string key = setting.substr(0, separator);
+		vector<string> values;
+		istringstream stream(setting.substr(separator + 1));
+		
+		for (string value; getline(stream, value, ',');)
+			values.push_back(value);
+		
+		cout << "Setting " << key << ".. " << flush;
+		g_network->pushOutgoingPacket(createSetSetting(key, values));
+		
+		bool completed;
+		waitForJob(completed);
+	}
+}
+
+// Drifted speakers are calibrated again with multitone
+void verifySoundImage() {
+	cout << "Verifying sound image...\t" << flush;
+	g_network->pushOutgoingPacket(createSoundImage(g_ips, g_external_microphones, g_mic_gains, false, MULTITONE, PACKET_VERIFY_SOUND_IMAGE));
+	
+	bool completed;
+	auto answer = waitForJob(completed);
+	
+	if (!completed) {
+		cout << endl;
+		return;
+	}
+	
+	int num_drifted = answer.getInt();
+	
+	if (num_drifted == 0)
+		cout << "No speaker has drifted\n";
+	
+	for (int i = 0; i < num_drifted; i++)
+		cout << answer.getString() << " had drifted and was calibrated again\n";
+		
+	cout << endl;
 }
 
 void run(const string& host, unsigned short port) {
@@ -292,6 +555,8 @@ void run(const string& host, unsigned short port) {
 	cout << "done!\n\n";
 	
 	g_network = &network;
+	joinSession();
+	setSessionSettings();
 	
 	while (true) {
 		cout << "1. Check if speakers are online (also enables SSH)\n\n";
@@ -308,7 +573,14 @@ void run(const string& host, unsigned short port) {
 		cout << "10. Disable EQ in all speakers\n";
 		cout << "11. Enable Axis sound effects\n";
 		cout << "12. Disable Axis sound effects\n\n";
-		cout << "13. Set to speaker defaults (all IPs)\n";
+		cout << "13. Set to speaker defaults (all IPs)\n\n";
+		cout << "14. Calibrate sound image (multiple sweeps)\n";
+		cout << "15. Calibrate sound image (sweep)\n";
+		cout << "16. Calibrate sound image (MLS)\n";
+		cout << "17. Calibrate sound image (multitone)\n";
+		cout << "18. Verify sound image (calibrate drifted speakers)\n\n";
+		cout << "19. Job status\n";
+		cout << "20. Cancel job\n";
 		cout << "\n: ";
 		
 		int input;
@@ -356,6 +628,27 @@ void run(const string& host, unsigned short port) {
 			case 13: resetEverything();
 				break;
 				
+			case 14: soundImage(MULTIPLE_SWEEPS);
+				break;
+				
+			case 15: soundImage(SWEEP);
+				break;
+				
+			case 16: soundImage(MAXIMUM_LENGTH_SEQUENCE);
+				break;
+				
+			case 17: soundImage(MULTITONE);
+				break;
+				
+			case 18: verifySoundImage();
+				break;
+				
+			case 19: jobStatus(false);
+				break;
+				
+			case 20: jobStatus(true);
+				break;
+				
 			case 99: testing();
 				break;
 				
@@ -0,0 +1,186 @@
+#include "Localization3D.h"
+#include "Base.h"
+#include "Config.h"
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+#include <armadillo>
+
+using namespace std;
+
+/*
+	Synthetic benchmark for Localization3D::run
+
+	Usage: bench/LocalizationBench [trials] [max nodes] [room size]
+
+	Random layouts are generated inside a room, the true distance matrix gets gaussian noise and
+	the solver output is compared to the truth after removing rotation, translation and mirroring,
+	since distances alone can't tell those apart. Solver settings are read from the config file and
+	can be overridden with the usual config keys through the environment, e.g. degree_accuracy=5.
+	A run fails above a mean positional error of bench_failure_error meters, 0.5 unless set.
+*/
+
+struct BenchResult {
+	double time_ms_ = 0;
+	double error_ = 0;
+	bool failed_ = false;
+};
+
+static void overrideConfig(const string& key) {
+	auto* value = getenv(key.c_str());
+
+	if (value == nullptr)
+		return;
+
+	Base::config().internal()[key] = { value };
+}
+
+// Mean positional error after the best orthogonal alignment (Procrustes)
+static double getAlignedError(const vector<vector<double>>& truth, const vector<vector<double>>& result) {
+	size_t n = truth.size();
+	arma::mat a(n, 3, arma::fill::zeros);
+	arma::mat b(n, 3, arma::fill::zeros);
+
+	for (size_t i = 0; i < n; i++) {
+		for (size_t k = 0; k < 3; k++) {
+			a(i, k) = truth.at(i).at(k);
+
+			if (k < result.at(i).size())
+				b(i, k) = result.at(i).at(k);
+		}
+	}
+
+	a.each_row() -= arma::mean(a, 0);
+	b.each_row() -= arma::mean(b, 0);
+
+	// Reflections are allowed on purpose, a mirrored layout has the same distances
+	arma::mat u, v;
+	arma::vec s;
+	arma::svd(u, s, v, b.t() * a);
+
+	arma::mat aligned = b * u * v.t();
+	double error = 0;
+
+	for (size_t i = 0; i < n; i++)
+		error += arma::norm(aligned.row(i) - a.row(i));
+
+	return error / n;
+}
+
+static BenchResult runTrial(size_t nodes, bool use_2d, double noise, double room_size, mt19937& generator) {
+	uniform_real_distribution<double> position(0, room_size);
+	uniform_real_distribution<double> height(0, room_size / 3);
+	normal_distribution<double> error(0, noise > 0 ? noise : 1);
+
+	vector<vector<double>> truth;
+
+	for (size_t i = 0; i < nodes; i++)
+		truth.push_back({ position(generator), position(generator), use_2d ? 0 : height(generator) });
+
+	// Measurements are symmetric on the real system as well
+	vector<vector<double>> distances(nodes, vector<double>(nodes, 0));
+
+	for (size_t i = 0; i < nodes; i++) {
+		for (size_t j = i + 1; j < nodes; j++) {
+			double distance = 0;
+
+			for (size_t k = 0; k < 3; k++)
+				distance += pow(truth.at(i).at(k) - truth.at(j).at(k), 2);
+
+			distance = sqrt(distance) + (noise > 0 ? error(generator) : 0);
+			distances.at(i).at(j) = distances.at(j).at(i) = max(distance, 0.0);
+		}
+	}
+
+	Localization3DInput input;
+
+	for (size_t i = 0; i < nodes; i++)
+		input.push_back({ to_string(i), distances.at(i) });
+
+	Base::config().internal()["use_2d"] = { use_2d ? "1" : "0" };
+
+	// The solver is chatty, keep the table readable
+	ostringstream discard;
+	auto* original = cout.rdbuf(discard.rdbuf());
+
+	auto start = chrono::steady_clock::now();
+	auto result = Localization3D::run(input, Base::config().get<bool>("fast"));
+	auto end = chrono::steady_clock::now();
+
+	cout.rdbuf(original);
+
+	BenchResult bench;
+	bench.time_ms_ = chrono::duration<double, milli>(end - start).count();
+
+	if (result.size() != nodes) {
+		bench.failed_ = true;
+
+		return bench;
+	}
+
+	bench.error_ = getAlignedError(truth, result);
+	bench.failed_ = bench.error_ > (Base::config().has("bench_failure_error") ? Base::config().get<double>("bench_failure_error") : 0.5);
+
+	return bench;
+}
+
+int main(int argc, char** argv) {
+	size_t trials = argc > 1 ? stoul(argv[1]) : 5;
+	size_t max_nodes = argc > 2 ? stoul(argv[2]) : 64;
+	double room_size = argc > 3 ? stod(argv[3]) : 8;
+
+	Base::config().parse("config");
+
+	for (auto& key : { "degree_accuracy", "point_accuracy", "fast", "timeout", "bench_failure_error" })
+		overrideConfig(key);
+
+	cout << "degree_accuracy " << Base::config().get<int>("degree_accuracy")
+		<< ", point_accuracy " << Base::config().get<double>("point_accuracy")
+		<< ", fast " << Base::config().get<bool>("fast")
+		<< ", timeout " << Base::config().get<int>("timeout") << " s"
+		<< ", " << trials << " trials per case\n\n";
+
+	cout << left << setw(6) << "dims" << setw(8) << "nodes" << setw(10) << "noise" << setw(14) << "mean ms" << setw(14) << "max ms" << setw(14) << "mean err" << "failures\n";
+
+	for (bool use_2d : { true, false }) {
+		for (size_t nodes : { 4, 6, 8, 12, 16, 24, 32, 48, 64 }) {
+			if (nodes > max_nodes)
+				continue;
+
+			for (double noise : { 0.0, 0.02, 0.05, 0.1 }) {
+				// Same layouts for every solver change
+				mt19937 generator(nodes * 1000 + static_cast<int>(noise * 100) * 10 + use_2d);
+
+				double total_time = 0;
+				double max_time = 0;
+				double total_error = 0;
+				size_t failures = 0;
+
+				for (size_t i = 0; i < trials; i++) {
+					auto result = runTrial(nodes, use_2d, noise, room_size, generator);
+
+					total_time += result.time_ms_;
+					max_time = max(max_time, result.time_ms_);
+
+					if (result.failed_)
+						failures++;
+					else
+						total_error += result.error_;
+				}
+
+				cout << left << setw(6) << (use_2d ? "2D" : "3D") << setw(8) << nodes << setw(10) << noise
+					<< setw(14) << total_time / trials << setw(14) << max_time
+					<< setw(14) << (failures < trials ? total_error / (trials - failures) : NAN)
+					<< failures << "/" << trials << endl;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -6,6 +6,8 @@
 #include "Base.h"
 #include "System.h"
 #include "Config.h"
+#include "Trace.h"
+#include "Log.h"
 
 // SigPack
 #include <sigpack/sigpack.h>
@@ -59,7 +61,8 @@ static vector<size_t> getBandIndex(double frequency, const vector<double>& limit
 	return indicies;
 }
 
-static set<int> g_ignore_bands;
+// Per thread, EQs of different speakers and sessions are simulated concurrently
+static thread_local set<int> g_ignore_bands;
 
 static double correctMaxEQ(vector<double>& eq) {
 	double total_mean_change = 0;
@@ -142,11 +145,12 @@ double interpolate( vector<double> &xData, vector<double> &yData, double x, bool
 	return yL + dydx * ( x - xL );                                              // linear interpolation
 }
 
-static int g_f_low = -1;
-static int g_f_high = -1;
+static thread_local int g_f_low = -1;
+static thread_local int g_f_high = -1;
 
 namespace nac {
 	FFTOutput doFFT(const vector<short>& samples, size_t start, size_t stop) {
+		ScopedTimer timer("doFFT");
 		size_t max_size = (stop == 0 ? samples.size() : stop);
 		vector<double> in;
 		in.resize(max_size);
@@ -165,7 +169,7 @@ namespace nac {
 		// 1 Hz resolution assures that adding additional curves applies correctly
 		int N = 65536;
 
-		cout << "Debug: set N to " << N << endl;
+		LOG_DEBUG("set N to " << N);
 
 		arma::vec y = arma::abs(sp::pwelch(arma::vec(in), N, N / 2));
 
@@ -207,7 +211,7 @@ namespace nac {
 		double high_freq = Base::config().get<double>("high_shelf_freq");
 		double high_gain = Base::config().get<double>("high_shelf_gain");
 
-		cout << "Creating shelving with Q " << SHELF_Q << endl;
+		LOG_DEBUG("Creating shelving with Q " << SHELF_Q);
 
 		// Create the actual IIR
 		Filter low_shelf_filter(low_freq, SHELF_Q, LOW_SHELF);
@@ -246,7 +250,7 @@ namespace nac {
 			Lp -= spl;
 			Lp = -Lp;
 
-			cout << "For SPL " << spl << " and freq " << f[i] << " db " << Lp << endl;
+			LOG_DEBUG("For SPL " << spl << " and freq " << f[i] << " db " << Lp);
 			freqs.push_back(Lp);
 		}
 
@@ -389,7 +393,8 @@ namespace nac {
 		return fitBands(input, eq_settings, false).first;
 	}
 
-	vector<double> findSimulatedEQSettings(const vector<short>& samples, FilterBank filter, size_t start, size_t stop) {
+	// Without samples the EQ is always simulated on the spectrum
+	static vector<double> simulateEQSettings(const FFTOutput& fft_output, FilterBank& filter, const vector<short>& samples, size_t start, size_t stop) {
 		g_f_low = -1;
 		g_f_high = -1;
 
@@ -401,14 +406,11 @@ namespace nac {
 		double best_score = INT_MAX;
 		double target_db = 0;
 
-		auto fft_output = nac::doFFT(samples, start, stop);
-
 		for (int i = 0; i < Base::config().get<int>("max_simulation_iterations"); i++) {
 			correctMaxEQ(eq_change);
 
 			vector<pair<int, double>> gains;
 
-			cout << "Trying EQ: ";
 			for (size_t i = 0; i < speaker_eq_frequencies.size(); i++) {
 				double actual_change = eq_change.at(i);
 
@@ -417,9 +419,9 @@ namespace nac {
 				}
 
 				gains.push_back({ speaker_eq_frequencies.at(i), actual_change });
-				cout << actual_change << " ";
 			}
-			cout << endl;
+
+			LOG_DEBUG("Trying EQ: " << joinValues(eq_change));
 
 			vector<short> simulated_samples;
 			auto response = fft_output;
@@ -453,11 +455,11 @@ namespace nac {
 				}
 			}
 
-			if (Base::config().get<bool>("enable_fast_parametric")) {
+			if (Base::config().get<bool>("enable_fast_parametric") || samples.empty()) {
 				filter.apply(samples, simulated_samples, gains, 48000);
 				response = nac::toDecibel(response);
 
-				#pragma omp parallel for
+				#pragma omp parallel for copyin(g_session)
 				for (size_t x = 1; x < response.first.size(); x++) {
 					response.second.at(x) += filter.gainAt(response.first.at(x), 48000);
 				}
@@ -470,7 +472,7 @@ namespace nac {
 				response = nac::doFFT(simulated_samples, start, stop);
 			}
 
-			cout << "Transformed to:\n";
+			LOG_DEBUG("Transformed to:");
 			auto peer = nac::fitBands(response, speaker_eq, false, target_db == 0 ? -20000 : target_db);
 
 			bool hardware_profile = Base::config().get<bool>("enable_hardware_profile");
@@ -514,7 +516,7 @@ namespace nac {
 				/* Convert back to linear */
 				response = nac::toLinear(response);
 
-				cout << "After target curve manipulations:\n";
+				LOG_DEBUG("After target curve manipulations:");
 				peer = nac::fitBands(response, speaker_eq, false, target_db == 0 ? -20000 : target_db);
 			}
 
@@ -535,7 +537,7 @@ namespace nac {
 					}
 				}
 				target_db = sum_target / num_target;//mean(negative_curve);
-				cout << "Setting target DB to " << target_db << endl;
+				LOG_DEBUG("Setting target DB to " << target_db);
 			}
 
 			/* Calculate distance to target */
@@ -571,21 +573,26 @@ namespace nac {
 					break;
 			}
 
-			cout << "Adding EQ: ";
-			for (size_t i = 0; i < eq.size(); i++) {
-				// Small changes for many bands
-				eq_change.at(i) += eq.at(i) / Base::config().get<double>("simulation_slowdown");
-
-				cout << eq.at(i) << " ";
-			}
-			cout << endl;
+			LOG_DEBUG("Adding EQ: " << joinValues(eq));
 
-			cout << endl;
+			// Small changes for many bands
+			for (size_t i = 0; i < eq.size(); i++)
+				eq_change.at(i) += eq.at(i) / Base::config().get<double>("simulation_slowdown");
 		}
 
 		return best_eq;
 	}
 
+	vector<double> findSimulatedEQSettings(const vector<short>& samples, FilterBank filter, size_t start, size_t stop) {
+		ScopedTimer timer("findSimulatedEQSettings");
+		return simulateEQSettings(nac::doFFT(samples, start, stop), filter, samples, start, stop);
+	}
+
+	vector<double> findSimulatedEQSettings(const FFTOutput& response, FilterBank filter) {
+		ScopedTimer timer("findSimulatedEQSettings");
+		return simulateEQSettings(response, filter, vector<short>(), 0, 0);
+	}
+
 	pair<vector<double>, double> fitBands(const FFTOutput& input, const pair<vector<double>, double>& eq_settings, bool input_db, double target_db) {
 		auto& eq_frequencies = eq_settings.first;
 
@@ -597,7 +604,7 @@ namespace nac {
 			double lower = centre / width;
 			double upper = centre * width;
 
-			cout << "Calculated width " << width << " with lower " << lower << " and upper " << upper << endl;
+			LOG_DEBUG("Calculated width " << width << " with lower " << lower << " and upper " << upper);
 
 			band_limits.push_back(lower);
 			band_limits.push_back(upper);
@@ -609,7 +616,7 @@ namespace nac {
 		FFTOutput actual = input;
 
 		if (input_db)
-			cout << "Warning: dB input not supported\n";
+			LOG_WARNING("dB input not supported");
 
 		auto& frequencies = actual.first;
 		auto& dbs = actual.second;
@@ -636,7 +643,7 @@ namespace nac {
 				continue;
 
 			if (frequency < 35)
-				cout << "energy " << frequency << " " << db << " avg " << avg_energy << endl;
+				LOG_DEBUG("energy " << frequency << " " << db << " avg " << avg_energy);
 
 			if (db >= avg_energy) {
 				if (f_low < 0)
@@ -670,7 +677,7 @@ namespace nac {
 			g_f_high = f_high;
 		else
 			f_high = g_f_high;
-		cout << "f_low " << f_low << " f_high " << f_high << endl;
+		LOG_DEBUG("f_low " << f_low << " f_high " << f_high);
 
 		for (size_t i = 0; i < dbs.size(); i++) {
 			auto& frequency = frequencies.at(i);
@@ -700,7 +707,7 @@ namespace nac {
 #endif
 		}
 
-		cout << "Lower resolution to fit EQ band with size " << eq_frequencies.size() << endl;
+		LOG_DEBUG("Lower resolution to fit EQ band with size " << eq_frequencies.size());
 
 		vector<int> mean_band;
 		vector<double> db_vec;
@@ -721,7 +728,7 @@ namespace nac {
 						energy.at(i) = target_db;
 					else
 						mean_band.push_back(i);
-					cout << "IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i) << endl;
+					LOG_DEBUG("IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i));
 					g_ignore_bands.insert(lround(eq_frequencies.at(i)));
 					continue;
 				}
@@ -731,7 +738,7 @@ namespace nac {
 							energy.at(i) = target_db;
 						else
 							mean_band.push_back(i);
-						cout << "IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i) << endl;
+						LOG_DEBUG("IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i));
 						g_ignore_bands.insert(lround(eq_frequencies.at(i)));
 						continue;
 					}
@@ -744,7 +751,7 @@ namespace nac {
 							energy.at(i) = target_db;
 						else
 							mean_band.push_back(i);
-						cout << "IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i) << endl;
+						LOG_DEBUG("IGNORING Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i));
 						g_ignore_bands.insert(lround(eq_frequencies.at(i)));
 						continue;
 					}
@@ -760,7 +767,7 @@ namespace nac {
 			db_vec.push_back(energy.at(i));
 			nums++;
 
-			cout << "Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i) << endl;
+			LOG_DEBUG("Frequency\t" << eq_frequencies.at(i) << "\t:\t" << energy.at(i));
 		}
 
 		if (!mean_band.empty()) {
@@ -770,7 +777,7 @@ namespace nac {
 		}
 
 		auto db_std_dev = calculateSD(db_vec);
-		cout << "db_std_dev " << db_std_dev << endl;
+		LOG_DEBUG("db_std_dev " << db_std_dev);
 
 		return { energy, db_std_dev };
 	}
@@ -23,6 +23,7 @@ namespace nac {
 	std::pair<std::vector<double>, double> fitBands(const FFTOutput& input, const std::pair<std::vector<double>, double>& eq_settings, bool input_db, double target_db = -20000);
 	std::vector<double> getEQ(const FFTOutput& input, const std::pair<std::vector<double>, double>& eq_settings);
 	std::vector<double> findSimulatedEQSettings(const std::vector<short>& samples, FilterBank filter, size_t start, size_t stop);
+	std::vector<double> findSimulatedEQSettings(const FFTOutput& response, FilterBank filter);
 }
 
 #endif
\ No newline at end of file
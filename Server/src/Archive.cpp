@@ -0,0 +1,158 @@
+#include "Archive.h"
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static bool writeFile(const string& to, const string& contents) {
+	string temporary = to + ".tmp";
+	ofstream file(temporary, ios::binary);
+
+	if (!file.is_open())
+		return false;
+
+	file.write(contents.data(), contents.size());
+	file.close();
+
+	// Readers never see a half written file
+	return !file.fail() && rename(temporary.c_str(), to.c_str()) == 0;
+}
+
+static bool copyFile(const string& from, const string& to) {
+	ifstream input(from, ios::binary);
+
+	if (!input.is_open())
+		return false;
+
+	string temporary = to + ".tmp";
+	ofstream output(temporary, ios::binary);
+
+	if (!output.is_open())
+		return false;
+
+	output << input.rdbuf();
+	output.close();
+
+	return !output.fail() && rename(temporary.c_str(), to.c_str()) == 0;
+}
+
+Archive::Archive() :
+	thread_(&Archive::run, this) {
+}
+
+Archive::~Archive() {
+	{
+		lock_guard<mutex> guard(mutex_);
+		stop_ = true;
+	}
+
+	condition_.notify_all();
+	thread_.join();
+}
+
+void Archive::run() {
+	while (true) {
+		function<void()> job;
+
+		{
+			unique_lock<mutex> lock(mutex_);
+			condition_.wait(lock, [this] () { return stop_ || !jobs_.empty(); });
+
+			// Finish the queue before stopping
+			if (jobs_.empty())
+				break;
+
+			job = jobs_.front();
+			jobs_.pop_front();
+		}
+
+		job();
+	}
+}
+
+void Archive::add(const function<void()>& job) {
+	{
+		lock_guard<mutex> guard(mutex_);
+		jobs_.push_back(job);
+	}
+
+	condition_.notify_one();
+}
+
+// Like mkdir -p for the folder of file
+bool Archive::createDirectories(const string& file) {
+	auto end = file.find_last_of('/');
+
+	if (end == string::npos || end == 0)
+		return true;
+
+	string folder = file.substr(0, end);
+	lock_guard<mutex> guard(directories_mutex_);
+
+	if (directories_.count(folder))
+		return true;
+
+	for (size_t position = folder.find('/', 1); ; position = folder.find('/', position + 1)) {
+		string part = folder.substr(0, position);
+
+		if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+			cout << "Warning: could not create " << part << ": " << strerror(errno) << endl;
+
+			return false;
+		}
+
+		if (position == string::npos)
+			break;
+	}
+
+	directories_.insert(folder);
+
+	return true;
+}
+
+void Archive::addFile(const string& from, const string& to) {
+	if (!createDirectories(to))
+		return;
+
+	// Linking is a single call, only copies are left to the thread
+	if (unlink(to.c_str()) != 0 && errno != ENOENT)
+		cout << "Warning: could not replace " << to << ": " << strerror(errno) << endl;
+
+	if (link(from.c_str(), to.c_str()) == 0)
+		return;
+
+	// Different file systems, keep the current contents with a link next to from since it may be
+	// replaced before the copy runs, the thread copies and removes it
+	static atomic<unsigned int> links(0);
+	string source = from + ".archive" + to_string(links++);
+	bool linked = link(from.c_str(), source.c_str()) == 0;
+
+	if (!linked) {
+		cout << "Warning: could not link " << from << ": " << strerror(errno) << ", copying it later instead" << endl;
+		source = from;
+	}
+
+	add([source, to, linked] () {
+		if (!copyFile(source, to))
+			cout << "Warning: could not archive " << source << " to " << to << endl;
+
+		if (linked)
+			unlink(source.c_str());
+	});
+}
+
+void Archive::addText(const string& to, const string& contents) {
+	if (!createDirectories(to))
+		return;
+
+	add([to, contents] () {
+		if (!writeFile(to, contents))
+			cout << "Warning: could not write " << to << endl;
+	});
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <list>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+	Saves captures and settings of calibration runs without blocking the request. Files are
+	hard linked into place right away when possible, everything else is written by a background
+	thread. Files on another file system are first linked next to where they are, and copied
+	from that link by the thread. Since links share the data, recordings have to be replaced
+	(unlinked) and not overwritten once archived, see System::getRecordings().
+*/
+class Archive {
+public:
+	Archive();
+	~Archive();
+
+	// Works like cp, to is replaced if it exists
+	void addFile(const std::string& from, const std::string& to);
+	void addText(const std::string& to, const std::string& contents);
+
+private:
+	void run();
+	void add(const std::function<void()>& job);
+	bool createDirectories(const std::string& file);
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::list<std::function<void()>> jobs_;
+	bool stop_ = false;
+
+	// Directories known to exist, callers can be jobs running at the same time
+	std::mutex directories_mutex_;
+	std::set<std::string> directories_;
+
+	// Last, everything above has to exist when it starts
+	std::thread thread_;
+};
+
+#endif
@@ -2,23 +2,74 @@
 #include "System.h"
 #include "Config.h"
 #include "NetworkCommunication.h"
+#include "Archive.h"
+#include "ResultsStore.h"
+#include "JobExecutor.h"
+#include "SSHPool.h"
+#include "SimulatedDevices.h"
+#include "CaptureStream.h"
+#include "Trace.h"
+#include "Session.h"
+
+Session* g_session = nullptr;
+#pragma omp threadprivate(g_session)
 
 System Base::system_;
 Config Base::config_;
 NetworkCommunication* Base::network_ = nullptr;
+Archive Base::archive_;
+ResultsStore Base::results_;
+// Shared by all sessions, before the jobs using it
+SSHPool Base::ssh_;
+SimulatedDevices Base::simulated_;
+CaptureStream Base::captures_;
+// Before the jobs, they can still be tracing while shutting down
+Trace Base::trace_;
+JobExecutor Base::jobs_;
 
 System& Base::system() {
-	return system_;
+	return g_session == nullptr ? system_ : g_session->getSystem();
 }
 
 Config& Base::config() {
-	return config_;
+	return g_session == nullptr ? config_ : g_session->getConfig();
 }
 
 NetworkCommunication& Base::network() {
 	return *network_;
 }
 
+Archive& Base::archive() {
+	return archive_;
+}
+
+ResultsStore& Base::results() {
+	return results_;
+}
+
+JobExecutor& Base::jobs() {
+	return jobs_;
+}
+
+// Chosen by the server config, every session has to talk to the same speakers
+DeviceBackend& Base::devices() {
+	static bool simulated = config_.get<std::string>("device_backend", "ssh") == "simulated";
+
+	if (simulated)
+		return simulated_;
+
+	return ssh_;
+}
+
+CaptureStream& Base::captures() {
+	return captures_;
+}
+
+// Sessions run one job at a time, so a run has its session's trace to itself
+Trace& Base::trace() {
+	return g_session == nullptr ? trace_ : g_session->getTrace();
+}
+
 void Base::startNetwork(int port) {
 	network_ = new NetworkCommunication(port);
 }
\ No newline at end of file
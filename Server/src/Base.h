@@ -5,12 +5,33 @@
 class System;
 class Config;
 class NetworkCommunication;
+class Archive;
+class ResultsStore;
+class JobExecutor;
+class DeviceBackend;
+class SSHPool;
+class SimulatedDevices;
+class CaptureStream;
+class Trace;
+class Session;
+
+// Session of the job running on this thread, see Session.h for how it reaches other threads
+extern Session* g_session;
+#pragma omp threadprivate(g_session)
 
 class Base {
 public:
+	// The ones of the current session if there is one
 	static System& system();
 	static Config& config();
 	static NetworkCommunication& network();
+	static Archive& archive();
+	static ResultsStore& results();
+	static JobExecutor& jobs();
+	// The speakers over SSH or simulated ones, see device_backend in config
+	static DeviceBackend& devices();
+	static CaptureStream& captures();
+	static Trace& trace();
 	
 	static void startNetwork(int port);
 	
@@ -18,6 +39,13 @@ private:
 	static System system_;
 	static Config config_;
 	static NetworkCommunication* network_;
+	static Archive archive_;
+	static ResultsStore results_;
+	static SSHPool ssh_;
+	static SimulatedDevices simulated_;
+	static CaptureStream captures_;
+	static JobExecutor jobs_;
+	static Trace trace_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "CaptureCodec.h"
+#include "Log.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+static const size_t HEADER_SIZE = 16;
+static const size_t BLOCK_HEADER_SIZE = 8;
+static const int ESCAPE = 24;
+static const int ESCAPE_BITS = 24;
+static const int VERBATIM = 255;
+
+class BitReader {
+public:
+	BitReader(const unsigned char* data, size_t size) :
+		data_(data), size_(size) {
+	}
+
+	// Reads past the end give zeros, the caller checks isOverrun()
+	uint32_t get(int bits) {
+		while (count_ < bits) {
+			bits_ = (bits_ << 8) | (position_ < size_ ? data_[position_] : 0);
+			position_++;
+			count_ += 8;
+		}
+
+		count_ -= bits;
+
+		return static_cast<uint32_t>(bits_ >> count_) & static_cast<uint32_t>((1ULL << bits) - 1);
+	}
+
+	bool isOverrun() const {
+		return position_ > size_;
+	}
+
+private:
+	const unsigned char* data_;
+	size_t size_;
+	size_t position_ = 0;
+	uint64_t bits_ = 0;
+	int count_ = 0;
+};
+
+static uint32_t getLittleEndian(const unsigned char* data, int bytes) {
+	uint32_t value = 0;
+
+	for (int i = bytes - 1; i >= 0; i--)
+		value = (value << 8) | data[i];
+
+	return value;
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return value & 1 ? -static_cast<int32_t>(value >> 1) - 1 : static_cast<int32_t>(value >> 1);
+}
+
+static bool decodeBlock(const unsigned char* payload, size_t size, size_t count, int order, int k, vector<short>& output) {
+	BitReader reader(payload, size);
+	auto start = output.size();
+
+	if (order == VERBATIM) {
+		for (size_t i = 0; i < count; i++)
+			output.push_back(static_cast<short>(reader.get(16)));
+
+		return !reader.isOverrun();
+	}
+
+	for (int i = 0; i < order && static_cast<size_t>(i) < count; i++)
+		output.push_back(static_cast<short>(reader.get(16)));
+
+	for (size_t i = order; i < count; i++) {
+		uint32_t quotient = 0;
+
+		while (quotient < static_cast<uint32_t>(ESCAPE) && reader.get(1) == 1)
+			quotient++;
+
+		uint32_t value = quotient < static_cast<uint32_t>(ESCAPE) ? (quotient << k) | reader.get(k) : reader.get(ESCAPE_BITS);
+		int32_t prediction = 0;
+		auto* samples = &output[start];
+
+		if (order == 1)
+			prediction = samples[i - 1];
+		else if (order == 2)
+			prediction = 2 * samples[i - 1] - samples[i - 2];
+
+		output.push_back(static_cast<short>(prediction + unzigzag(value)));
+	}
+
+	return !reader.isOverrun();
+}
+
+bool CaptureCodec::decode(const string& filename, vector<short>& output) {
+	ifstream file(filename, ios::binary);
+
+	if (!file.is_open()) {
+		LOG_ERROR("could not open compressed recording " << filename);
+
+		return false;
+	}
+
+	vector<unsigned char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	if (data.size() < HEADER_SIZE || memcmp(data.data(), "NACP", 4) != 0 || data.at(4) != 1 || data.at(5) != 1) {
+		LOG_ERROR(filename << " is not a compressed mono recording");
+
+		return false;
+	}
+
+	size_t block_size = getLittleEndian(&data.at(6), 2);
+	output.clear();
+
+	for (size_t position = HEADER_SIZE; position < data.size(); ) {
+		if (position + BLOCK_HEADER_SIZE > data.size()) {
+			LOG_ERROR(filename << " is truncated");
+
+			return false;
+		}
+
+		const auto* header = &data.at(position);
+		size_t count = getLittleEndian(header, 2);
+		int order = header[2];
+		int k = header[3];
+		size_t size = getLittleEndian(header + 4, 4);
+
+		position += BLOCK_HEADER_SIZE;
+
+		if (count > block_size || (order > 2 && order != VERBATIM) || k > 31 || position + size > data.size() || !decodeBlock(&data.at(0) + position, size, count, order, k, output)) {
+			LOG_ERROR(filename << " has a broken block at byte " << position - BLOCK_HEADER_SIZE);
+
+			return false;
+		}
+
+		position += size;
+	}
+
+	return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef CAPTURE_CODEC_H
+#define CAPTURE_CODEC_H
+
+#include <vector>
+#include <string>
+
+/*
+	Decoder for recordings compressed on the speakers with tools/nacpack.c, lossless so the
+	analysis sees exactly what arecord recorded.
+
+	Little endian header of 16 bytes: "NACP", version (1), channels (1), block size (uint16),
+	sample rate (uint32) and 4 reserved bytes. Then blocks until the end of the file, each with
+	the number of samples (uint16), predictor order (uint8), Rice parameter k (uint8) and the
+	payload size in bytes (uint32). The payload holds the first order samples as they are and
+	the zigzag mapped residuals of the rest, Rice coded MSB first, where 24 ones are followed by
+	the residual in 24 bits instead. Blocks with order 255 hold the samples as they are.
+*/
+class CaptureCodec {
+public:
+	static bool decode(const std::string& filename, std::vector<short>& output);
+};
+
+#endif
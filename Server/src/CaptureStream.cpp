@@ -0,0 +1,279 @@
+#include "CaptureStream.h"
+#include "Base.h"
+#include "Config.h"
+#include "Log.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace std;
+
+// How often blocking calls look for stop_
+static const int POLL_MS = 500;
+
+CaptureStream::~CaptureStream() {
+	{
+		lock_guard<mutex> guard(mutex_);
+		stop_ = true;
+	}
+
+	condition_.notify_all();
+
+	if (thread_.joinable())
+		thread_.join();
+
+	for (auto& receiver : receivers_)
+		receiver.thread_.join();
+
+	if (socket_ >= 0)
+		close(socket_);
+}
+
+bool CaptureStream::start(unsigned short port) {
+	lock_guard<mutex> guard(mutex_);
+
+	if (socket_ >= 0)
+		return true;
+
+	int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (listener < 0) {
+		LOG_ERROR("capture stream socket() failed: " << strerror(errno));
+
+		return false;
+	}
+
+	int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0) {
+		LOG_ERROR("could not listen for capture streams on port " << port << ": " << strerror(errno));
+		close(listener);
+
+		return false;
+	}
+
+	socket_ = listener;
+	thread_ = thread(&CaptureStream::accept, this);
+
+	LOG_INFO("Listening for capture streams on port " << port);
+
+	return true;
+}
+
+void CaptureStream::expect(const string& ip, size_t samples) {
+	lock_guard<mutex> guard(mutex_);
+	auto& capture = captures_[ip];
+
+	// A connection of an earlier recording still around is ignored from now on
+	capture.generation_++;
+	capture.samples_.clear();
+	capture.samples_.reserve(samples);
+	capture.expected_ = samples;
+	capture.ended_ = false;
+	capture.connected_ = false;
+	capture.last_data_ = chrono::steady_clock::now();
+}
+
+bool CaptureStream::wait(const string& ip, size_t samples, vector<short>& data, bool partial) {
+	auto timeout = chrono::seconds(Base::config().get<int>("capture_stream_timeout", 10));
+	// Reaching the microphone over SSH and starting the recording comes first
+	auto connect_timeout = chrono::seconds(Base::config().get<int>("capture_stream_connect_timeout", 60));
+	unique_lock<mutex> lock(mutex_);
+	auto iterator = captures_.find(ip);
+
+	if (iterator == captures_.end()) {
+		LOG_ERROR("no capture stream expected from " << ip);
+
+		return false;
+	}
+
+	auto& capture = iterator->second;
+
+	while (capture.samples_.size() < samples) {
+		bool stalled = chrono::steady_clock::now() - capture.last_data_ > (capture.connected_ ? timeout : connect_timeout);
+
+		if (capture.ended_ || stalled || stop_) {
+			// arecord can stop a little short, then whatever arrived is the recording
+			if (partial && !capture.samples_.empty()) {
+				LOG_WARNING("capture stream from " << ip << " has " << capture.samples_.size() << " of " << samples << " samples");
+
+				break;
+			}
+
+			LOG_ERROR("capture stream from " << ip << (capture.ended_ ? " ended" : capture.connected_ ? " stalled" : " never connected") << " after " << capture.samples_.size() << " of " << samples << " samples");
+
+			return false;
+		}
+
+		condition_.wait_for(lock, chrono::milliseconds(POLL_MS));
+	}
+
+	data.assign(capture.samples_.begin(), capture.samples_.begin() + min(samples, capture.samples_.size()));
+
+	return true;
+}
+
+bool CaptureStream::waitFor(const string& ip, size_t samples, vector<short>& data) {
+	return wait(ip, samples, data, false);
+}
+
+bool CaptureStream::get(const string& ip, vector<short>& data) {
+	size_t expected = 0;
+
+	{
+		lock_guard<mutex> guard(mutex_);
+		auto iterator = captures_.find(ip);
+
+		if (iterator != captures_.end())
+			expected = iterator->second.expected_;
+	}
+
+	return wait(ip, expected, data, true);
+}
+
+void CaptureStream::accept() {
+	while (true) {
+		{
+			lock_guard<mutex> guard(mutex_);
+
+			if (stop_)
+				break;
+
+			// Forget the receivers of finished streams
+			for (auto iterator = receivers_.begin(); iterator != receivers_.end(); ) {
+				if (iterator->done_) {
+					iterator->thread_.join();
+					iterator = receivers_.erase(iterator);
+				} else {
+					iterator++;
+				}
+			}
+		}
+
+		pollfd listener = { socket_, POLLIN, 0 };
+
+		if (poll(&listener, 1, POLL_MS) <= 0)
+			continue;
+
+		int connection = ::accept(socket_, nullptr, nullptr);
+
+		if (connection < 0) {
+			LOG_WARNING("capture stream accept() failed: " << strerror(errno));
+
+			continue;
+		}
+
+		lock_guard<mutex> guard(mutex_);
+		receivers_.emplace_back();
+		receivers_.back().thread_ = thread(&CaptureStream::receive, this, connection, &receivers_.back());
+	}
+}
+
+// Like recv() but gives up when stopping, so shutting down doesn't wait for a silent microphone
+ssize_t CaptureStream::read(int socket, char* buffer, size_t size) {
+	while (true) {
+		{
+			lock_guard<mutex> guard(mutex_);
+
+			if (stop_)
+				return -1;
+		}
+
+		pollfd connection = { socket, POLLIN, 0 };
+		int ready = poll(&connection, 1, POLL_MS);
+
+		if (ready < 0)
+			return -1;
+
+		if (ready > 0)
+			return recv(socket, buffer, size, 0);
+	}
+}
+
+void CaptureStream::receive(int socket, Receiver* receiver) {
+	// The first line is the IP of the microphone
+	string ip;
+	char character;
+
+	while (ip.size() < 64 && read(socket, &character, 1) == 1 && character != '\n')
+		ip += character;
+
+	unsigned int generation = 0;
+
+	{
+		lock_guard<mutex> guard(mutex_);
+		auto iterator = captures_.find(ip);
+
+		if (iterator != captures_.end() && !iterator->second.ended_) {
+			generation = iterator->second.generation_;
+
+			// The stall timeout starts now
+			iterator->second.connected_ = true;
+			iterator->second.last_data_ = chrono::steady_clock::now();
+		}
+	}
+
+	if (generation == 0) {
+		LOG_WARNING("unexpected capture stream from \"" << ip << "\"");
+	} else {
+		LOG_INFO("Capture stream from " << ip << " connected");
+
+		vector<char> buffer(1 << 16);
+		size_t pending = 0;
+
+		while (true) {
+			auto received = read(socket, buffer.data() + pending, buffer.size() - pending);
+			bool ended = received <= 0;
+
+			if (!ended)
+				pending += received;
+
+			// An odd byte waits for the rest of its sample
+			size_t samples = pending / sizeof(short);
+
+			{
+				lock_guard<mutex> guard(mutex_);
+				auto& capture = captures_[ip];
+
+				if (capture.generation_ != generation)
+					break;
+
+				samples = min(samples, capture.expected_ - capture.samples_.size());
+
+				auto* data = reinterpret_cast<const short*>(buffer.data());
+				capture.samples_.insert(capture.samples_.end(), data, data + samples);
+				capture.last_data_ = chrono::steady_clock::now();
+
+				// Closing it ends nc on the microphone, whether or not it quits by itself
+				if (capture.samples_.size() >= capture.expected_)
+					ended = true;
+
+				capture.ended_ = ended;
+			}
+
+			condition_.notify_all();
+
+			if (ended)
+				break;
+
+			memmove(buffer.data(), buffer.data() + samples * sizeof(short), pending - samples * sizeof(short));
+			pending -= samples * sizeof(short);
+		}
+	}
+
+	close(socket);
+
+	lock_guard<mutex> guard(mutex_);
+	receiver->done_ = true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef CAPTURE_STREAM_H
+#define CAPTURE_STREAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <sys/types.h>
+
+/*
+	Recordings streamed from the microphones while they record instead of fetched as files
+	afterwards. The record command pipes a line with the IP of the microphone followed by the
+	raw samples from arecord through nc to capture_stream_port, and the samples are kept in
+	memory as they arrive. Analysis of a speaker can start as soon as its part of the recording
+	is in, see waitFor(). Shared by all sessions, they never record with the same microphone at
+	the same time.
+*/
+class CaptureStream {
+public:
+	~CaptureStream();
+
+	// Listens on port unless it already does
+	bool start(unsigned short port);
+
+	// Starts over for a recording of samples from ip, earlier data is dropped
+	void expect(const std::string& ip, size_t samples);
+
+	// Waits until ip has sent samples and copies them, false if the stream ended or stalled first
+	bool waitFor(const std::string& ip, size_t samples, std::vector<short>& data);
+	// Waits for the whole recording
+	bool get(const std::string& ip, std::vector<short>& data);
+
+private:
+	struct Capture {
+		std::vector<short> samples_;
+		size_t expected_ = 0;
+		unsigned int generation_ = 0;
+		bool ended_ = false;
+		bool connected_ = false;
+		// When expected until the microphone connects, then its last data
+		std::chrono::steady_clock::time_point last_data_;
+	};
+
+	struct Receiver {
+		std::thread thread_;
+		bool done_ = false;
+	};
+
+	bool wait(const std::string& ip, size_t samples, std::vector<short>& data, bool partial);
+	void accept();
+	void receive(int socket, Receiver* receiver);
+	ssize_t read(int socket, char* buffer, size_t size);
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::map<std::string, Capture> captures_;
+	std::list<Receiver> receivers_;
+	int socket_ = -1;
+	bool stop_ = false;
+
+	std::thread thread_;
+};
+
+#endif
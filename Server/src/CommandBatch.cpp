@@ -0,0 +1,57 @@
+#include "CommandBatch.h"
+#include "Base.h"
+#include "System.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void CommandBatch::add(const string& ip, const string& command) {
+	auto iterator = find(ips_.begin(), ips_.end(), ip);
+
+	if (iterator == ips_.end()) {
+		ips_.push_back(ip);
+		scripts_.emplace_back();
+		iterator = ips_.end() - 1;
+	}
+
+	auto& script = scripts_.at(distance(ips_.begin(), iterator));
+	script += command;
+
+	// Commands may end with "; " or nothing at all
+	if (!script.empty() && script.back() != '\n')
+		script += '\n';
+}
+
+void CommandBatch::add(const vector<string>& ips, const string& command) {
+	vector<string> added;
+
+	for (auto& ip : ips) {
+		if (find(added.begin(), added.end(), ip) != added.end())
+			continue;
+
+		add(ip, command);
+		added.push_back(ip);
+	}
+}
+
+void CommandBatch::add(const vector<string>& ips, const vector<string>& commands) {
+	for (size_t i = 0; i < ips.size(); i++)
+		add(ips.at(i), commands.at(i));
+}
+
+bool CommandBatch::run() {
+	if (empty())
+		return true;
+
+	auto outputs = Base::system().runScript(ips_, scripts_);
+
+	ips_.clear();
+	scripts_.clear();
+
+	return !outputs.empty();
+}
+
+bool CommandBatch::empty() const {
+	return ips_.empty();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#ifndef COMMAND_BATCH_H
+#define COMMAND_BATCH_H
+
+#include <vector>
+#include <string>
+
+/*
+	Setup and teardown commands collected into one script per speaker, so e.g. stopping the
+	audio system and setting the test settings is one runScript() round trip instead of one
+	each. Every speaker runs its commands in the order they were added. Measurement scripts are
+	timed against the other speakers and must not be batched, run them after run().
+*/
+class CommandBatch {
+public:
+	// The same command on every IP, a speaker listed twice (e.g. playing and recording) runs it once
+	void add(const std::vector<std::string>& ips, const std::string& command);
+	// One command per IP, in the same order
+	void add(const std::vector<std::string>& ips, const std::vector<std::string>& commands);
+
+	// Sends everything added so far and starts over, false if any speaker failed
+	bool run();
+	bool empty() const;
+
+private:
+	void add(const std::string& ip, const std::string& command);
+
+	// In the order the speakers were first added
+	std::vector<std::string> ips_;
+	std::vector<std::string> scripts_;
+};
+
+#endif
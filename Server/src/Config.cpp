@@ -1,7 +1,10 @@
 #include "Config.h"
+#include "Log.h"
 
 #include <vector>
 #include <fstream>
+#include <set>
+#include <mutex>
 
 using namespace std;
 
@@ -29,7 +32,7 @@ void Config::parse(const string& filename) {
 	ifstream file(filename);
 
 	if (!file.is_open()) {
-		cout << "Could not open config " << filename << endl;
+		LOG_WARNING("Could not open config " << filename);
 
 		return;
 	}
@@ -45,15 +48,10 @@ void Config::parse(const string& filename) {
 		// Remove ':' from the setting
 		tokens.front().pop_back();
 
-		cout << "Set key " << tokens.front() << " to value(s): ";
-
 		string key = tokens.front();
 		tokens.pop_front();
 
-		for (auto& token : tokens)
-			cout << token << " ";
-
-		cout << endl;
+		LOG_INFO("Set key " << key << " to value(s): " << joinValues(tokens));
 
 		add({ key, tokens });
 	}
@@ -61,6 +59,16 @@ void Config::parse(const string& filename) {
 	file.close();
 }
 
+void Config::missing(const string& key) {
+	static mutex missing_mutex;
+	static set<string> reported;
+
+	lock_guard<mutex> guard(missing_mutex);
+
+	if (reported.insert(key).second)
+		LOG_WARNING("No config value for key " << key);
+}
+
 void Config::clear() {
 	configs_.clear();
 }
@@ -21,7 +21,7 @@ public:
 		auto iterator = configs_.find(key);
 
 		if (iterator == configs_.end()) {
-			std::cout << "No config value for key " << key << std::endl;
+			missing(key);
 
 			return default_value;
 		}
@@ -38,7 +38,7 @@ public:
 		auto iterator = configs_.find(key);
 
 		if (iterator == configs_.end()) {
-			std::cout << "No config value for key " << key << std::endl;
+			missing(key);
 
 			return default_value;
 		}
@@ -59,6 +59,9 @@ public:
 private:
 	void add(const std::pair<std::string, std::deque<std::string>>& config);
 
+	// Warns once per key, get() is called from the analysis loops
+	static void missing(const std::string& key);
+
 	std::map<std::string, std::deque<std::string>> configs_;
 };
 
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef DEVICE_BACKEND_H
+#define DEVICE_BACKEND_H
+
+#include "Handle.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// What cksum prints for a file, cheap to compute on the speakers
+struct FileChecksum {
+	uint32_t crc_ = 0;
+	uint64_t size_ = 0;
+
+	bool operator==(const FileChecksum& other) const {
+		return crc_ == other.crc_ && size_ == other.size_;
+	}
+};
+
+/*
+	What System needs from the speakers, shared by all sessions. Either the real speakers over
+	SSH (SSHPool) or in-process ones (SimulatedDevices), see device_backend in config and
+	Base::devices().
+*/
+class DeviceBackend {
+public:
+	virtual ~DeviceBackend() = default;
+
+	// Connects what isn't connected, online status per IP
+	virtual std::vector<bool> connect(const std::vector<std::string>& ips) = 0;
+
+	// The commands of every speaker run in parallel, output per command in the order of ips.
+	// Empty if any speaker failed
+	virtual SSHOutput command(const std::vector<std::string>& ips, const std::vector<std::string>& commands) = 0;
+	virtual bool transferRemote(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) = 0;
+	virtual bool transferLocal(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) = 0;
+
+	virtual bool isOnline(const std::string& ip) = 0;
+	// 0 if the speaker is offline
+	virtual unsigned int getEpoch(const std::string& ip) = 0;
+
+	// Files known to be on a speaker, only as long as it stays connected with the same epoch
+	virtual bool hasFile(const std::string& ip, const std::string& path, const FileChecksum& checksum) = 0;
+	virtual void setFile(const std::string& ip, const std::string& path, const FileChecksum& checksum, unsigned int epoch) = 0;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "FilterBank.h"
 #include "Base.h"
 #include "Config.h"
+#include "Log.h"
 
 #include <cmath>
 #include <climits>
@@ -32,7 +33,8 @@ static double getFittingQ(double gain, double octave_width) {
 	/* BW to Q */
 	double q = sqrt(pow(2, bw)) / (pow(2, bw) - 1);
 
-	cout << "DEBUG: Return Q " << q << " for gain " << gain << endl;
+	LOG_DEBUG("Return Q " << q << " for gain " << gain);
+
 	return q;
 }
 
@@ -553,7 +555,7 @@ void FilterBank::applyFilters(vector<double>& normalized, double fs) {
 	fftwf_plan planForward = fftwf_plan_dft_1d(filterLength * 2, timeData, freqData, FFTW_FORWARD, FFTW_ESTIMATE);
 	fftwf_plan planReverse = fftwf_plan_dft_1d(filterLength * 2, freqData, timeData, FFTW_BACKWARD, FFTW_ESTIMATE);
 
-	#pragma omp parallel for
+	#pragma omp parallel for copyin(g_session)
 	for (unsigned i = 0; i < filterLength; i++)
 	{
 		double freq = i * 1.0 * fs / (filterLength * 2);
@@ -653,9 +655,10 @@ void FilterBank::apply(const vector<short>& samples, vector<short>& out, const v
 		normalized = filtered;
 	}
 
-	// Print highest peak
+#ifdef DEBUG
+	// Print highest peak, 20000 evaluations of the whole cascade so only in debug builds
 	double peak = INT_MIN;
-	double peak_freq;
+	double peak_freq = 0;
 
 	for (int i = 0; i < 20000; i++) {
 		auto gain = gainAt(i, fs);
@@ -666,7 +669,8 @@ void FilterBank::apply(const vector<short>& samples, vector<short>& out, const v
 		}
 	}
 
-	cout << "Highest filter peak is at " << peak_freq << " with gain " << peak << endl;
+	LOG_DEBUG("Highest filter peak is at " << peak_freq << " with gain " << peak);
+#endif
 
 	///* Apply all filters by creating an FIR */
 	//applyFilters(normalized, fs);
@@ -10,6 +10,17 @@
 #include "Config.h"
 #include "Analyze.h"
 #include "FilterBank.h"
+#include "Sweep.h"
+#include "MLS.h"
+#include "Archive.h"
+#include "ResultsStore.h"
+#include "JobExecutor.h"
+#include "Multitone.h"
+#include "ResponseMatrix.h"
+#include "Trace.h"
+#include "Session.h"
+#include "CaptureStream.h"
+#include "CommandBatch.h"
 
 #include <iostream>
 #include <cmath>
@@ -17,6 +28,13 @@
 #include <climits>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <exception>
 
 using namespace std;
 
@@ -39,11 +57,24 @@ enum {
 
 enum {
 	WHITE_NOISE,
-	NINE_FREQ
+	NINE_FREQ,
+	MULTIPLE_SWEEPS,
+	SWEEP,
+	MAXIMUM_LENGTH_SEQUENCE,
+	MULTITONE
 };
 
-// We're not multithreading anyway
-Connection* g_current_connection = nullptr;
+// Generated on the server so the deconvolution always matches what was played, see getSignalFile()
+static const string SWEEP_FILE = "nac_sweep";
+static const string MLS_FILE = "nac_mls";
+
+// Every speaker plays its own comb, followed by its IP
+static const string MULTITONE_FILE = "nac_multitone_";
+
+// Sessions have their own signal settings and can measure at the same time, so each writes its own files
+static string getSignalFile(const string& name) {
+	return name + "_" + to_string(g_session == nullptr ? 0 : g_session->getID()) + ".wav";
+}
 
 static vector<string> g_frequencies =	{	"63",
 											"125",
@@ -97,25 +128,25 @@ void to_523(double param_dec, unsigned char * param_hex) {
 	param_hex[0] = param_hex[0] ^ 0x08;
 }
 
-static void enableAudioSystem(const vector<string>& ips) {
+static void enableAudioSystem(const vector<string>& ips, CommandBatch& batch) {
 	cout << "Starting audio system\n";
 	/* We need to start audiocontrol as well, but don't know how except rebooting for now */
-	Base::system().runScript(ips, vector<string>(ips.size(), "systemctl start audio_relayd; wait\n"));
+	batch.add(ips, "systemctl start audio_relayd; wait\n");
 }
 
-static void disableAudioSystem(const vector<string>& ips) {
+static void disableAudioSystem(const vector<string>& ips, CommandBatch& batch) {
 	cout << "Stopping audio system\n";
-	Base::system().runScript(ips, vector<string>(ips.size(), "systemctl stop audio*; wait; systemctl restart dspd; wait\n"));
+	batch.add(ips, "systemctl stop audio*; wait; systemctl restart dspd; wait\n");
 }
 
 // It's like we were not here
-void resetEverything(const vector<string>& ips) {
+static void resetEverything(const vector<string>& ips, CommandBatch& batch) {
 	string command = 	"dspd -w Flat; wait; ";
 	command +=			"amixer -c0 sset 'Headphone' 57 on; wait; "; 				/* 57 is 0 dB for C1004-e */
 	command +=			"amixer -c0 sset 'Capture' 63; wait; ";
 	command +=			"amixer -c0 sset 'PGA Boost' 1; wait\n";
 
-	Base::system().runScript(ips, vector<string>(ips.size(), command));
+	batch.add(ips, command);
 
 	// Set system speaker settings as well
 	for (auto* speaker : Base::system().getSpeakers(ips)) {
@@ -124,12 +155,16 @@ void resetEverything(const vector<string>& ips) {
 	}
 }
 
-static void setTestSpeakerSettings(const vector<string>& ips) {
+// The EQ of the speakers is kept if keep_settings is set, e.g. when verifying a calibration
+static void setTestSpeakerSettings(const vector<string>& ips, CommandBatch& batch, bool keep_settings = false) {
 	/* Note: this is for c8033 with modded dspd */
-	string command =	"dspd -w Flat; wait; ";
+	string command =	keep_settings ? "" : "dspd -w Flat; wait; ";
 	command +=			"amixer -c0 sset 'Headphone' 57 on; wait; amixer -c0 sset 'Capture' 63; wait; amixer -c0 sset 'PGA Boost' 1; wait; ";
 
-	Base::system().runScript(ips, vector<string>(ips.size(), command));
+	batch.add(ips, command);
+
+	if (keep_settings)
+		return;
 
 	// Set system speaker settings as well
 	for (auto* speaker : Base::system().getSpeakers(ips)) {
@@ -138,15 +173,20 @@ static void setTestSpeakerSettings(const vector<string>& ips) {
 	}
 }
 
+// Back to normal playback after measuring, one round trip for all of them
+static void restoreSpeakers(const vector<string>& reset_ips, const vector<string>& enable_ips) {
+	CommandBatch batch;
+	resetEverything(reset_ips, batch);
+	enableAudioSystem(enable_ips, batch);
+	batch.run();
+}
+
 static vector<string> createRunLocalizationScripts(const vector<string>& ips, int play_time, int idle_time, const string& file) {
 	vector<string> scripts;
 
 	for (size_t i = 0; i < ips.size(); i++) {
-		string script =	"arecord -D audiosource -r 48000 -f S16_LE -c 1 -d ";
-		script +=		to_string(idle_time + ips.size() * (idle_time + play_time) + idle_time);
-		script +=		" /tmp/cap";
-		script +=		ips.at(i);
-		script +=		".wav &\n";
+		string script =	Base::system().getRecordCommand(ips.at(i), idle_time + ips.size() * (idle_time + play_time) + idle_time);
+		script +=		" &\n";
 		script +=		"proc1=$!\n";
 		script +=		"sleep ";
 		script +=		to_string(idle_time + i * (play_time + idle_time));
@@ -183,6 +223,196 @@ static PlacementOutput assemblePlacementOutput(const vector<Speaker*> speakers)
 	return output;
 }
 
+// Keep track of which localization this is
+// Shared by every session, a new ID always means a new localization
+static atomic<int> g_placement_id(-1);
+
+// Plays the localization tone from every IP and returns the distance matrix between them
+static Localization3DInput measureDistances(const vector<string>& ips) {
+	JobExecutor::progress("measuring distances", "", 10);
+
+	if (!Base::config().get<bool>("no_scripts")) {
+		// Create scripts
+		int play_time = Base::config().get<int>("play_time_localization");
+		int idle_time = Base::config().get<int>("idle_time");
+
+		Base::system().prepareRecordings(ips);
+		auto scripts = createRunLocalizationScripts(ips, play_time, idle_time, Base::config().get<string>("goertzel"));
+
+		// Disable audio system and set test speaker settings
+		CommandBatch setup;
+		disableAudioSystem(ips, setup);
+		setTestSpeakerSettings(ips, setup);
+		setup.run();
+
+		// Send test files
+		Base::system().sendFile(ips, "data/" + Base::config().get<string>("goertzel"), "/tmp/");
+
+		// Start localization scripts
+		Base::system().runScript(ips, scripts);
+
+		// Reset speaker settings and enable audio system again, the recordings stay on the speakers
+		restoreSpeakers(ips, ips);
+
+		// Collect data
+		Base::system().getRecordings(ips);
+	}
+
+	JobExecutor::progress("analysing distances", "", 50);
+
+	return Goertzel::runGoertzel(ips);
+}
+
+static double getDistance(const vector<double>& a, const vector<double>& b) {
+	double sum = 0;
+
+	for (size_t i = 0; i < min(a.size(), b.size()); i++)
+		sum += (a.at(i) - b.at(i)) * (a.at(i) - b.at(i));
+
+	return sqrt(sum);
+}
+
+// Spread out anchors by repeatedly picking the speaker furthest from the chosen ones
+static vector<Speaker*> pickAnchors(const vector<Speaker*>& placed, size_t wanted) {
+	vector<Speaker*> anchors = { placed.front() };
+	vector<Speaker*> left(placed.begin() + 1, placed.end());
+
+	while (anchors.size() < wanted && !left.empty()) {
+		auto furthest = max_element(left.begin(), left.end(), [&anchors] (Speaker* a, Speaker* b) {
+			double distance_a = INT_MAX;
+			double distance_b = INT_MAX;
+
+			for (auto* anchor : anchors) {
+				distance_a = min(distance_a, getDistance(a->getPlacement().getCoordinates(), anchor->getPlacement().getCoordinates()));
+				distance_b = min(distance_b, getDistance(b->getPlacement().getCoordinates(), anchor->getPlacement().getCoordinates()));
+			}
+
+			return distance_a < distance_b;
+		});
+
+		anchors.push_back(*furthest);
+		left.erase(furthest);
+	}
+
+	return anchors;
+}
+
+/*
+	Measures only new or changed speakers against a few already placed anchors and places
+	them on top of the existing solution. Returns false if a global re-solve is needed.
+
+	The only check for movement is the distances between the anchors, placed speakers which
+	aren't anchors are never measured again and are assumed to still be where they were.
+*/
+static bool runIncrementalLocalization(const vector<Speaker*>& placed, const vector<Speaker*>& changed) {
+	size_t wanted = Base::config().get<bool>("use_2d") ? 3 : 4;
+	double max_residual = Base::config().get<double>("localization_incremental_max_residual");
+
+	if (placed.size() < wanted) {
+		cout << "Not enough placed speakers for incremental localization\n";
+
+		return false;
+	}
+
+	auto anchors = pickAnchors(placed, wanted);
+	vector<string> ips;
+
+	for (auto* anchor : anchors)
+		ips.push_back(anchor->getIP());
+
+	for (auto* speaker : changed)
+		ips.push_back(speaker->getIP());
+
+	cout << "Running incremental localization for " << changed.size() << " speaker(s) against " << anchors.size() << " anchors\n";
+
+	auto distances = measureDistances(ips);
+
+	if (distances.size() != ips.size())
+		return false;
+
+	// Anchors which no longer agree with their stored distances have moved
+	for (size_t i = 0; i < anchors.size(); i++) {
+		for (size_t j = i + 1; j < anchors.size(); j++) {
+			double stored = getDistance(anchors.at(i)->getPlacement().getCoordinates(), anchors.at(j)->getPlacement().getCoordinates());
+			double measured = distances.at(i).second.at(j);
+
+			if (abs(stored - measured) > max_residual) {
+				cout << "Anchor " << ips.at(i) << " -> " << ips.at(j) << " moved " << abs(stored - measured) << " m\n";
+
+				return false;
+			}
+		}
+	}
+
+	// Place changed speakers one by one, later ones may use earlier ones as anchors
+	vector<vector<double>> positions;
+
+	for (auto* anchor : anchors)
+		positions.push_back(anchor->getPlacement().getCoordinates());
+
+	for (size_t i = anchors.size(); i < ips.size(); i++) {
+		vector<double> anchor_distances(distances.at(i).second.begin(), distances.at(i).second.begin() + i);
+		double residual;
+
+		auto position = Localization3D::place(positions, anchor_distances, residual);
+
+		cout << "Placed " << ips.at(i) << " with residual " << residual << " m\n";
+
+		if (residual > max_residual)
+			return false;
+
+		positions.push_back(position);
+	}
+
+	// Only the new speakers and the anchors were measured against each other, the pairs between
+	// the other placed speakers and the new ones are derived from the solved coordinates so every
+	// speaker in the new localization has a complete distance table
+	vector<Speaker*> speakers(placed.begin(), placed.end());
+	vector<Speaker::SpeakerPlacement> placements;
+
+	for (size_t i = anchors.size(); i < ips.size(); i++)
+		speakers.push_back(&Base::system().getSpeaker(ips.at(i)));
+
+	// Index in ips, or ips.size() if not measured now
+	auto getIndex = [&ips] (Speaker* speaker) {
+		return static_cast<size_t>(distance(ips.begin(), find(ips.begin(), ips.end(), speaker->getIP())));
+	};
+
+	auto getCoordinates = [&] (Speaker* speaker) {
+		auto index = getIndex(speaker);
+
+		return index < ips.size() && index >= anchors.size() ? positions.at(index) : speaker->getPlacement().getCoordinates();
+	};
+
+	for (auto* speaker : speakers) {
+		auto index = getIndex(speaker);
+		bool is_new = index < ips.size() && index >= anchors.size();
+		auto speaker_placement = is_new ? Speaker::SpeakerPlacement(speaker->getIP()) : speaker->getPlacement();
+
+		for (auto* peer : speakers) {
+			auto peer_index = getIndex(peer);
+			bool peer_new = peer_index < ips.size() && peer_index >= anchors.size();
+
+			if (index < ips.size() && peer_index < ips.size())
+				speaker_placement.addDistance(peer->getIP(), distances.at(index).second.at(peer_index));
+			else if (is_new || peer_new)
+				speaker_placement.addDistance(peer->getIP(), getDistance(getCoordinates(speaker), getCoordinates(peer)));
+
+			// Placed speakers keep what they had between themselves
+		}
+
+		speaker_placement.setCoordinates(getCoordinates(speaker));
+		placements.push_back(speaker_placement);
+	}
+
+	int placement_id = ++g_placement_id;
+
+	for (size_t i = 0; i < speakers.size(); i++)
+		speakers.at(i)->setPlacement(placements.at(i), placement_id);
+
+	return true;
+}
+
 PlacementOutput Handle::runLocalization(const vector<string>& ips, bool force_update) {
 	if (ips.empty())
 		return PlacementOutput();
@@ -202,45 +432,35 @@ PlacementOutput Handle::runLocalization(const vector<string>& ips, bool force_up
 		return assemblePlacementOutput(speakers);
 	}
 
-	if (!Base::config().get<bool>("no_scripts")) {
-		// Create scripts
-		int play_time = Base::config().get<int>("play_time_localization");
-		int idle_time = Base::config().get<int>("idle_time");
-
-		auto scripts = createRunLocalizationScripts(ips, play_time, idle_time, Base::config().get<string>("goertzel"));
-
-		// Disable audio system
-		disableAudioSystem(ips);
-
-		// Send test files
-		Base::system().sendFile(ips, "data/" + Base::config().get<string>("goertzel"), "/tmp/");
-
-		// Set test speaker settings
-		setTestSpeakerSettings(ips);
-
-		// Start localization scripts
-		Base::system().runScript(ips, scripts);
+	if (!force_update && Base::config().get<bool>("localization_incremental")) {
+		// Speakers from the newest localization are kept, the rest are new or changed
+		int newest = *max_element(placement_ids.begin(), placement_ids.end());
+		vector<Speaker*> placed;
+		vector<Speaker*> changed;
+
+		for (auto* speaker : speakers) {
+			if (newest >= 0 && speaker->getPlacementID() == newest)
+				placed.push_back(speaker);
+			else
+				changed.push_back(speaker);
+		}
 
-		// Reset speaker settings
-		resetEverything(ips);
+		if (!placed.empty() && runIncrementalLocalization(placed, changed))
+			return assemblePlacementOutput(speakers);
 
-		// Collect data
-		Base::system().getRecordings(ips);
-
-		// Enable audio system again
-		enableAudioSystem(ips);
+		cout << "Falling back to global localization\n";
 	}
 
-	auto distances = Goertzel::runGoertzel(ips);
+	auto distances = measureDistances(ips);
 
 	if (distances.empty())
 		return PlacementOutput();
 
+	JobExecutor::progress("solving positions", "", 70);
+
 	auto placement = Localization3D::run(distances, Base::config().get<bool>("fast"));
 
-	// Keep track of which localization this is
-	static int placement_id = -1;
-	placement_id++;
+	int placement_id = ++g_placement_id;
 
 	for (size_t i = 0; i < ips.size(); i++) {
 		Speaker::SpeakerPlacement speaker_placement(ips.at(i));
@@ -370,6 +590,7 @@ static void setSpeakerVolume(const string& ip, double volume, double base_dsp_le
 #endif
 
 static void setEQ(const vector<string>& speaker_ips, int type) {
+	ScopedTimer timer("setEQ");
 	auto speakers = Base::system().getSpeakers(speaker_ips);
 	vector<string> commands;
 
@@ -493,108 +714,65 @@ static void setSpeakersEQ(const vector<string>& speaker_ips, int type) {
 }
 #endif
 
-static vector<vector<double>> weightEQs(const vector<string>& speaker_ips, const vector<string>& mic_ips, const MicWantedEQ& eqs) {
-	auto num_bands = Base::system().getSpeakerProfile().getNumEQBands();
-
-	// Initialize to 0 EQ
-	vector<vector<double>> final_eqs(eqs.front().size(), vector<double>(num_bands, 0));
-	vector<vector<double>> total_linear_energy = vector<vector<double>>(speaker_ips.size(), vector<double>(num_bands, 0));
-
-	// Find total linear energy
-	for (int i = 0; i < num_bands; i++) {
-		// Go through microphones
-		for (size_t j = 0; j < eqs.size(); j++) {
-			// Go through speakers
-			for (size_t k = 0; k < eqs.at(j).size(); k++) {
-				// Frequency response for this speaker
-				auto response = Base::system().getSpeaker(mic_ips.at(j)).getFrequencyResponseFrom(speaker_ips.at(k)).at(i);
-				auto db_type = Base::system().getSpeaker(mic_ips.at(j)).getdBType();
-				double linear_energy = pow(10, response / db_type);
-
-				total_linear_energy.at(k).at(i) += linear_energy;
-			}
-		}
-	}
-
-	// Set weights
-	for (int i = 0; i < num_bands; i++) {
-		// Go through microphones
-		for (size_t j = 0; j < eqs.size(); j++) {
-			// Go through speakers
-			for (size_t k = 0; k < eqs.at(j).size(); k++) {
-				// Frequency response for this speaker
-				auto response = Base::system().getSpeaker(mic_ips.at(j)).getFrequencyResponseFrom(speaker_ips.at(k)).at(i);
-				auto db_type = Base::system().getSpeaker(mic_ips.at(j)).getdBType();
-				double linear_energy = pow(10, response / db_type);
-
-				double weight = linear_energy / total_linear_energy.at(k).at(i);
+// Every speaker plays filename after the previous one, all_ips are the IPs of the scripts
+static vector<string> createFrequencyResponseScripts(const vector<string>& speakers, const vector<string>& mics, const string& filename, int play, vector<string>& all_ips) {
+	Base::system().prepareRecordings(mics);
+	vector<string> scripts;
 
-				// Get EQ at frequency j
-				double wanted_eq = eqs.at(j).at(k).at(i);
+	auto idle = Base::config().get<int>("idle_time");
+	//auto play = Base::config().get<int>("play_time");
 
-				cout << "Speaker " << speaker_ips.at(k) << " has weight " << weight << " and adding EQ " << weight * wanted_eq << " to band " << i << endl;
+	for (size_t i = 0; i < speakers.size(); i++) {
+		string script = "sleep " + to_string(idle + i * (play + idle)) + "; wait; ";
+		script +=		"aplay -D localhw_0 -r 48000 -f S16_LE /tmp/" + filename + "; wait\n";
 
-				// Sk[i] += weight * Mj[i]
-				final_eqs.at(k).at(i) += weight * wanted_eq;
-			}
-		}
+		scripts.push_back(script);
 	}
 
-	return final_eqs;
-}
-
-static vector<double> weightGain(const vector<string>& speaker_ips, const vector<string>& mic_ips, const vector<double>& changes) {
-	vector<double> linear_sound_levels(speaker_ips.size(), 0);
-	vector<double> final_change(speaker_ips.size(), 0);
-
-	// Total sound level
-	// Go through microphones
-	for (size_t i = 0; i < mic_ips.size(); i++) {
-		// Go through speakers
-		for (size_t j = 0; j < speaker_ips.size(); j++) {
-			auto sound_level = Base::system().getSpeaker(mic_ips.at(i)).getSoundLevelFrom(speaker_ips.at(j));
-			double linear = (double)SHRT_MAX * pow(10, sound_level / 20);
+	for (auto& ip : mics) {
+		string script =	Base::system().getRecordCommand(ip, idle + speakers.size() * (play + idle)) + "; wait\n";
 
-			linear_sound_levels.at(j) += linear;
-		}
+		scripts.push_back(script);
 	}
 
-	// Set weights
-	// Go through microphones
-	for (size_t i = 0; i < mic_ips.size(); i++) {
-		// Go through speakers
-		for (size_t j = 0; j < speaker_ips.size(); j++) {
-			auto sound_level = Base::system().getSpeaker(mic_ips.at(i)).getSoundLevelFrom(speaker_ips.at(j));
-
-			double linear = (double)SHRT_MAX * pow(10, sound_level / 20);
-			double weight = linear / linear_sound_levels.at(j);
+	all_ips = speakers;
+	all_ips.insert(all_ips.end(), mics.begin(), mics.end());
 
-			double wanted_change = changes.at(i) * weight;
-			final_change.at(j) += wanted_change;
+	return scripts;
+}
 
-			cout << "Microphone " << mic_ips.at(i) << " added " << wanted_change << " to " << speaker_ips.at(j) << " with weight " << weight << " and actual change " << changes.at(i) << endl;
-		}
-	}
+static void runFrequencyResponseScripts(const vector<string>& speakers, const vector<string>& mics, const string& filename, int play) {
+	vector<string> all_ips;
+	auto scripts = createFrequencyResponseScripts(speakers, mics, filename, play, all_ips);
 
-	return final_change;
+	ScopedTimer timer("playback");
+	Base::system().runScript(all_ips, scripts);
 }
 
-static void runFrequencyResponseScripts(const vector<string>& speakers, const vector<string>& mics, const string& filename, int play) {
+/*
+	Every speaker starts playing stagger seconds after the previous one. With sweeps and a
+	stagger shorter than the sweep this is the multiple exponential sweep method, where all
+	responses fit in roughly one sweep instead of one per speaker.
+*/
+static void runStaggeredScripts(const vector<string>& speakers, const vector<string>& mics, const vector<string>& filenames, double duration, int stagger) {
+	Base::system().prepareRecordings(mics);
+	ScopedTimer timer("playback");
 	vector<string> scripts;
 
 	auto idle = Base::config().get<int>("idle_time");
-	//auto play = Base::config().get<int>("play_time");
 
 	for (size_t i = 0; i < speakers.size(); i++) {
-		string script = "sleep " + to_string(idle + i * (play + idle)) + "; wait; ";
-		script +=		"aplay -D localhw_0 -r 48000 -f S16_LE /tmp/" + filename + "; wait\n";
+		string script = "sleep " + to_string(idle + i * stagger) + "; wait; ";
+		script +=		"aplay -D localhw_0 -r 48000 -f S16_LE /tmp/" + filenames.at(i) + "; wait\n";
 
 		scripts.push_back(script);
 	}
 
+	// Leave room for the reverberation of the last sweep
+	auto record = 2 * idle + (speakers.size() - 1) * stagger + lround(ceil(duration));
+
 	for (auto& ip : mics) {
-		string script =	"arecord -D audiosource -r 48000 -f S16_LE -c 1 -d " + to_string(idle + speakers.size() * (play + idle));
-		script +=		" /tmp/cap" + ip + ".wav; wait\n";
+		string script =	Base::system().getRecordCommand(ip, record) + "; wait\n";
 
 		scripts.push_back(script);
 	}
@@ -605,6 +783,10 @@ static void runFrequencyResponseScripts(const vector<string>& speakers, const ve
 	Base::system().runScript(all_ips, scripts);
 }
 
+static void runStaggeredScripts(const vector<string>& speakers, const vector<string>& mics, const string& filename, double duration, int stagger) {
+	runStaggeredScripts(speakers, mics, vector<string>(speakers.size(), filename), duration, stagger);
+}
+
 #if 0
 /*
 	Test different levels of dB until we find a common factor
@@ -799,6 +981,8 @@ static double getSoundLevel(const vector<string>& mic_ips) {
 #endif
 
 static void runTestSoundImage(const vector<string>& speaker_ips, const vector<string>& mic_ips, const string& filename) {
+	Base::system().prepareRecordings(mic_ips);
+	ScopedTimer timer("playback");
 	vector<string> scripts;
 
 	auto idle = Base::config().get<int>("idle_time");
@@ -811,7 +995,7 @@ static void runTestSoundImage(const vector<string>& speaker_ips, const vector<st
 		scripts.push_back(play_command);
 
 	for (auto& ip : mic_ips) {
-		string record_command =	"arecord -D audiosource -r 48000 -f S16_LE -c 1 -d " + to_string(idle + play + idle) + " /tmp/cap" + ip + ".wav; wait\n";
+		string record_command =	Base::system().getRecordCommand(ip, idle + play + idle) + "; wait\n";
 
 		scripts.push_back(record_command);
 	}
@@ -880,55 +1064,39 @@ static FFTOutput getWhiteResponse(const vector<short>& data, size_t sound_start,
 // From NetworkCommunication.cpp
 extern string getTimestamp();
 
-static string writeWhiteNoiseFiles(const string& where, string timestamp = "") {
-	if (timestamp.empty()) {
-		timestamp = getTimestamp();
-		// Remove whitespace
-		replace(timestamp.begin(), timestamp.end(), ' ', '_');
-		// Remove ':'
-		replace(timestamp.begin(), timestamp.end(), ':', '_');
-		timestamp.pop_back();
-		timestamp += '/';
-	}
+// Current time without whitespace and ':', usable in paths
+static string getRunID() {
+	auto timestamp = getTimestamp();
+	// Remove whitespace
+	replace(timestamp.begin(), timestamp.end(), ' ', '_');
+	// Remove ':'
+	replace(timestamp.begin(), timestamp.end(), ':', '_');
+	timestamp.pop_back();
 
-	if (!system(NULL)) {
-		cout << "WARNING: No shell available\n";
+	return timestamp;
+}
 
-		return timestamp;
-	}
+static string writeWhiteNoiseFiles(const string& where, const vector<string>& mic_ips, string timestamp = "") {
+	if (timestamp.empty())
+		timestamp = getRunID() + '/';
 
-	// Create folders for this data
+	// Folder for this data
 	string folder =	"../save/white_noises/";
 	folder +=		where + "/" + timestamp;
 
-	string mkdir = "mkdir " + folder;
-	string move = "cp results/cap* " + folder;
-
-	auto answer = system(mkdir.c_str());
-	answer = system(move.c_str());
+	for (auto& mic_ip : mic_ips)
+		Base::archive().addFile("results/cap" + mic_ip + ".wav", folder + "cap" + mic_ip + ".wav");
 
-	if (answer) {}
-
-	cout << "mkdir command: " << mkdir << endl;
-	cout << "move command: " << move << endl;
+	cout << "Archiving captures in " << folder << endl;
 
 	return timestamp;
 }
 
-static void writeEQSettings(const string& where, const string& timestamp, const vector<string>& speaker_ips) {
-	if (!system(NULL))
-		return;
-
+static string writeEQSettings(const string& where, const string& timestamp, const vector<string>& speaker_ips) {
 	string folder = "../save/white_noises/" + where + "/" + timestamp;
 	string file = folder + "eqs";
 
-	ofstream eqs(file);
-
-	if (!eqs.is_open()) {
-		cout << "Warning: could not open " << file << " for writing\n";
-
-		return;
-	}
+	ostringstream eqs;
 
 	auto speakers = Base::system().getSpeakers(speaker_ips);
 
@@ -940,39 +1108,24 @@ static void writeEQSettings(const string& where, const string& timestamp, const
 			eqs << setting << endl;
 	}
 
-	eqs.close();
-}
+	Base::archive().addText(file, eqs.str());
 
-static string moveFileMATLAB(const string& where, const string& timestamp, const vector<string>& mic_ips) {
-	string folder = "../save/white_noises/" + where + "/" + timestamp;
+	return eqs.str();
+}
 
-	vector<string> copy_after;
+static void storeCalibrationScores(const string& run, const string& room, const vector<string>& mic_ips, const string& field) {
+	for (auto& mic_ip : mic_ips)
+		Base::results().add(ResultsStore::getKey(run, room, "", mic_ip, field), vector<double>{ Base::system().getSpeaker(mic_ip).getSD().first });
+}
 
+// Copies the captures for MATLAB, has to be called while results has the captures of where
+static void moveFileMATLAB(const string& where, const vector<string>& mic_ips) {
 	if (mic_ips.size() > 1) {
 		for (auto& mic_ip : mic_ips)
-			copy_after.push_back("cp " + folder + "cap" + mic_ip + ".wav ../matlab/" + where + mic_ip + ".wav");
+			Base::archive().addFile("results/cap" + mic_ip + ".wav", "../matlab/" + where + mic_ip + ".wav");
 	} else {
-		copy_after.push_back("cp " + folder + "cap" + mic_ips.front() + ".wav ../matlab/" + where + ".wav");
-	}
-
-	for (auto& command : copy_after) {
-		cout << "Copy command: " << command << endl;
-		if (system(command.c_str())) {}
+		Base::archive().addFile("results/cap" + mic_ips.front() + ".wav", "../matlab/" + where + ".wav");
 	}
-
-	return folder;
-}
-
-static void moveToMATLAB(const string& timestamp, const vector<string>& mic_ips) {
-	if (!system(NULL))
-		return;
-
-	moveFileMATLAB("before", timestamp, mic_ips);
-	string folder_after = moveFileMATLAB("after", timestamp, mic_ips);
-	string copy_eqs = "cp " + folder_after + "eqs ../matlab/";
-
-	cout << "Copy EQs: " << copy_eqs << endl;
-	if (system(copy_eqs.c_str())) {}
 }
 
 static void addCustomerEQ(const vector<string>& speaker_ips) {
@@ -982,7 +1135,8 @@ static void addCustomerEQ(const vector<string>& speaker_ips) {
 		speaker->addCustomerEQ(g_customer_profile);
 }
 
-static void setCalibratedSoundLevel(const vector<string>& speaker_ips, const vector<string>& mic_ips, double adjusted_final_gain, bool only_check_dsp_gain) {
+static void setCalibratedSoundLevel(const vector<string>& speaker_ips, const vector<string>& mic_ips, const ResponseMatrix& responses, double adjusted_final_gain, bool only_check_dsp_gain) {
+	ScopedTimer timer("setCalibratedSoundLevel");
 	auto speakers = Base::system().getSpeakers(speaker_ips);
 	vector<double> final_gains;
 
@@ -1025,7 +1179,10 @@ static void setCalibratedSoundLevel(const vector<string>& speaker_ips, const vec
 		}
 
 		// Weight gain
-		auto final_change = weightGain(speaker_ips, mic_ips, changes);
+		auto final_change = responses.weightGain(changes);
+
+		for (size_t i = 0; i < speaker_ips.size(); i++)
+			cout << "Speaker " << speaker_ips.at(i) << " gets a gain change of " << final_change.at(i) << " dB\n";
 
 		for (size_t i = 0; i < speakers.size(); i++) {
 			auto* speaker = speakers.at(i);
@@ -1152,35 +1309,125 @@ void writeAPOSettings(const vector<double>& gains) {
 	file.close();
 }
 
-void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<string>& mic_ips, const vector<double>& gains, bool factor_calibration, int type) {
+static void runSoundImage(const vector<string>& speaker_ips, const vector<string>& mic_ips, const vector<double>& gains, bool factor_calibration, int type) {
 	auto adjusted_final_gain = getRelativeSignalGain(type);
 	cout << "adjusted_final_gain " << adjusted_final_gain << endl;
 
+	// Everything measured is saved in the results store under this run
+	auto run = getRunID();
+	auto room = Base::config().get<string>("results_room");
+
+	TraceRun trace_run(run);
+
 	// Set g_dsp_factor
 	bool run_white_noise = false;
+	bool run_sweeps = false;
+	bool run_sequential_sweeps = false;
+	bool run_mls = false;
+	bool run_multitone = false;
 	bool run_validation = Base::config().get<bool>("validate_white_noise");
 	bool ignore_new_eq_settings = Base::config().get<bool>("ignore_new_eq_settings");
 
 	if (type == WHITE_NOISE)
 		run_white_noise = true;
+	else if (type == MULTIPLE_SWEEPS || type == SWEEP)
+		run_sweeps = true;
+	else if (type == MAXIMUM_LENGTH_SEQUENCE)
+		run_mls = true;
+	else if (type == MULTITONE)
+		run_multitone = true;
+
+	if (type == SWEEP)
+		run_sequential_sweeps = true;
 
 	if (run_white_noise)
 		cout << "Running white noise sound image\n";
+	else if (run_sequential_sweeps)
+		cout << "Running sweep sound image\n";
+	else if (run_sweeps)
+		cout << "Running multiple sweep sound image\n";
+	else if (run_mls)
+		cout << "Running MLS sound image\n";
+	else if (run_multitone)
+		cout << "Running multitone sound image\n";
 	else
 		cout << "Running 9-freq tone sound image\n";
 
 	vector<string> all_ips(speaker_ips);
 	all_ips.insert(all_ips.end(), mic_ips.begin(), mic_ips.end());
 
-	// Disable audio system
-	disableAudioSystem(all_ips);
+	JobExecutor::progress("sending test signals", "", 5);
+
+	// Disable audio system and set test settings
+	CommandBatch setup;
+	disableAudioSystem(all_ips, setup);
+	setTestSpeakerSettings(all_ips, setup);
+	setup.run();
+
+	setGain(speaker_ips, vector<double>(speaker_ips.size(), Base::config().get<double>("calibration_safe_gain")));
 
 	// Send test files to speakers
 	Base::system().sendFile(speaker_ips, "data/" + Base::config().get<string>("white_noise"), "/tmp/", true);
 
-	if (!run_white_noise || factor_calibration)
+	if (type == NINE_FREQ || factor_calibration)
 		Base::system().sendFile(speaker_ips, "data/" + Base::config().get<string>("sound_image_file_short"), "/tmp/", true);
 
+	nac::SweepSettings sweep_settings;
+	vector<short> sweep;
+	int stagger = 0;
+
+	if (run_sweeps) {
+		sweep_settings = nac::getSweepSettings();
+		sweep = nac::createSweep(sweep_settings);
+
+		// One after another, with idle time for the reverberation in between
+		if (run_sequential_sweeps)
+			stagger = lround(ceil(sweep_settings.duration_)) + Base::config().get<int>("idle_time");
+		else
+			stagger = Base::config().get<int>("sweep_stagger");
+
+		WavReader::write("results/" + getSignalFile(SWEEP_FILE), sweep);
+		Base::system().sendFile(speaker_ips, "results/" + getSignalFile(SWEEP_FILE), "/tmp/", true);
+	}
+
+	unique_ptr<nac::MLS> mls;
+	vector<short> mls_signal;
+	auto mls_periods = Base::config().get<size_t>("mls_periods");
+	auto mls_level = Base::config().get<double>("mls_level");
+
+	if (run_mls) {
+		mls.reset(new nac::MLS(Base::config().get<int>("mls_order")));
+		mls_signal = mls->createSignal(mls_periods, mls_level);
+		stagger = lround(ceil(mls_signal.size() / 48000.0)) + Base::config().get<int>("idle_time");
+
+		WavReader::write("results/" + getSignalFile(MLS_FILE), mls_signal);
+		Base::system().sendFile(speaker_ips, "results/" + getSignalFile(MLS_FILE), "/tmp/", true);
+	}
+
+	unique_ptr<nac::Multitone> multitone;
+	vector<string> multitone_files;
+	double multitone_duration = 0;
+	auto multitone_periods = Base::config().get<size_t>("multitone_periods");
+
+	if (run_multitone) {
+		auto bands = Base::system().getSpeakerProfile().getSpeakerEQ().first;
+		multitone.reset(new nac::Multitone(Base::config().get<int>("multitone_order"), speaker_ips.size(), bands, Base::config().get<double>("dsp_octave_width"), Base::config().get<double>("multitone_level")));
+
+		vector<string> local_files;
+
+		for (size_t i = 0; i < speaker_ips.size(); i++) {
+			auto signal = multitone->createSignal(i, multitone_periods);
+			multitone_duration = signal.size() / 48000.0;
+
+			multitone_files.push_back(getSignalFile(MULTITONE_FILE + speaker_ips.at(i)));
+			local_files.push_back("results/" + multitone_files.back());
+
+			WavReader::write(local_files.back(), signal);
+		}
+
+		Base::system().sendFiles(speaker_ips, local_files, "/tmp/", true);
+	}
+
 	#if 0
 	// Find correction factor
 	if (factor_calibration) {
@@ -1188,7 +1435,9 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 
 		for (int i = 0; i < 25; i++) {
 			// Set test settings again
-			setTestSpeakerSettings(all_ips);
+			CommandBatch batch;
+			setTestSpeakerSettings(all_ips, batch);
+			batch.run();
 
 			// Set test DSP gain again
 			//setSpeakersEQ(speaker_ips, TYPE_FLAT_EQ);
@@ -1204,10 +1453,6 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 	}
 	#endif
 
-	// Set test settings
-	setTestSpeakerSettings(all_ips);
-	setGain(speaker_ips, vector<double>(speaker_ips.size(), Base::config().get<double>("calibration_safe_gain")));
-
 	string timestamp;
 
 	if (run_validation) {
@@ -1217,150 +1462,368 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 
 		// See calibration score before calibrating
 		showCalibrationScore(mic_ips, false);
+		storeCalibrationScores(run, room, mic_ips, "score_before");
 
-		timestamp = writeWhiteNoiseFiles("before");
+		timestamp = writeWhiteNoiseFiles("before", mic_ips);
+		moveFileMATLAB("before", mic_ips);
 	}
 
 	// Set test DSP gain
 	//setSpeakersEQ(speaker_ips, TYPE_FLAT_EQ);
 
+	JobExecutor::progress("measuring", "", 10);
+
 	// Run frequency responses
+	bool new_recordings = true;
+	function<void()> measure;
+
+	// Speakers playing one after another, see runFrequencyResponseScripts()
+	string sequential_file;
+	int sequential_play = 0;
+
 	if (run_white_noise) {
 		if (speaker_ips.size() > 1 || !run_validation) {
-			runFrequencyResponseScripts(speaker_ips, mic_ips, Base::config().get<string>("white_noise"), Base::config().get<int>("play_time"));
-			Base::system().getRecordings(mic_ips);
+			sequential_file = Base::config().get<string>("white_noise");
+			sequential_play = Base::config().get<int>("play_time");
+		} else {
+			new_recordings = false;
 		}
+	} else if (run_sweeps) {
+		measure = [&] () { runStaggeredScripts(speaker_ips, mic_ips, getSignalFile(SWEEP_FILE), sweep_settings.duration_, stagger); };
+	} else if (run_mls) {
+		measure = [&] () { runStaggeredScripts(speaker_ips, mic_ips, getSignalFile(MLS_FILE), mls_signal.size() / 48000.0, stagger); };
+	} else if (run_multitone) {
+		// Everyone at once, the combs keep the speakers apart
+		measure = [&] () { runStaggeredScripts(speaker_ips, mic_ips, multitone_files, multitone_duration, 0); };
 	} else {
-		runFrequencyResponseScripts(speaker_ips, mic_ips, Base::config().get<string>("sound_image_file_short"), Base::config().get<int>("play_time_freq"));
-		Base::system().getRecordings(mic_ips);
+		sequential_file = Base::config().get<string>("sound_image_file_short");
+		sequential_play = Base::config().get<int>("play_time_freq");
 	}
 
+	if (!sequential_file.empty())
+		measure = [&] () { runFrequencyResponseScripts(speaker_ips, mic_ips, sequential_file, sequential_play); };
+
+	// Speakers playing one after another can be analysed while the later ones still play, the rest need whole recordings
+	Base::system().prepareRecordings(mic_ips);
+	bool analyse_while_measuring = !sequential_file.empty() && Base::system().isStreamingRecordings();
+
+	if (measure && !analyse_while_measuring)
+		measure();
+
 	auto idle = Base::config().get<int>("idle_time");
 	auto play = Base::config().get<int>("play_time");
 
 	if (!run_white_noise)
 		play = Base::config().get<int>("play_time_freq");
 
-	// Wanted EQs by microphones
-	MicWantedEQ wanted_eqs(mic_ips.size());
-	vector<vector<short>> datas(mic_ips.size());
+	// Sweeps and MLS are analysed as impulse responses
+	bool run_impulse_responses = run_sweeps || run_mls;
+	vector<double> inverse;
+	vector<size_t> offsets;
+	size_t ir_length = 0;
+	size_t ir_fade = 0;
+	size_t pre_delay = 48000 / 1000;
 
-	#pragma omp parallel for
-	for (size_t i = 0; i < mic_ips.size(); i++) {
-		auto& mic_ip = mic_ips.at(i);
+	if (run_impulse_responses) {
+		double ir_time = Base::config().get<double>("sweep_window_ms") / 1000;
 
-		string filename = "results/cap" + mic_ip + ".wav";
-		WavReader::read(filename, datas.at(i));
+		if (run_sweeps) {
+			// Sweep responses have to end before the harmonics of the next sweep show up
+			double usable_time = stagger - sweep_settings.getRate() * log(3);
 
-		wanted_eqs.at(i) = vector<vector<double>>(speaker_ips.size());
-	}
+			if (usable_time < ir_time) {
+				cout << "Warning: harmonics of the next sweep start " << usable_time << " s into the response, increase sweep_stagger\n";
 
-	// Go through frequency analysis
-	#pragma omp parallel for collapse(2)
-	for (size_t z = 0; z < mic_ips.size(); z++) {
-		//vector<vector<double>> new_eqs(speaker_ips.size());
+				ir_time = max(usable_time, 0.01);
+			}
 
-		for (size_t i = 0; i < speaker_ips.size(); i++) {
-			double sound_start_sec = static_cast<double>(idle) * 2 + (i * (play + idle));
-			double sound_stop_sec = sound_start_sec + play - idle * 2;
-			size_t sound_start = lround(sound_start_sec * 48000.0);
-			size_t sound_stop = lround(sound_stop_sec * 48000.0);
+			inverse = nac::createInverseFilter(sweep, sweep_settings);
+		} else {
+			// MLS responses wrap around after one period
+			ir_time = min(ir_time, mls->size() / 48000.0);
+		}
 
-			vector<double> dbs;
-			vector<double> final_eq;
+		ir_length = lround(ir_time * 48000);
+		ir_fade = min<size_t>(lround(Base::config().get<double>("sweep_window_fade_ms") / 1000 * 48000), ir_length / 2);
 
-			auto& data = datas.at(z);
-			auto& mic_ip = mic_ips.at(z);
+		for (size_t i = 0; i < speaker_ips.size(); i++)
+			offsets.push_back((idle + i * stagger) * 48000);
+	}
 
-			if (run_white_noise) {
-				auto response = getWhiteResponse(data, sound_start, sound_stop);
-				//response = nac::toDecibel(response);
+	// Responses and wanted EQs by microphones
+	ResponseMatrix responses(mic_ips.size(), speaker_ips.size(), Base::system().getSpeakerProfile().getNumEQBands());
 
-				dbs = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
-				Base::system().getSpeaker(mic_ip).setdBType(DB_TYPE_POWER);
+	// Where speaker i plays in recordings of speakers playing one after another
+	auto getSegment = [&] (size_t i) {
+		double sound_start_sec = static_cast<double>(idle) * 2 + (i * (play + idle));
+		double sound_stop_sec = sound_start_sec + play - idle * 2;
 
-				// Calculate speaker EQ
-				if (Base::config().get<bool>("simulate_eq_settings")) {
-					final_eq = nac::findSimulatedEQSettings(data, Base::system().getSpeakerProfile().getFilter(), sound_start, sound_stop);
+		return pair<size_t, size_t>(lround(sound_start_sec * 48000.0), lround(sound_stop_sec * 48000.0));
+	};
 
-					cout << "Returned final_eq: ";
-					for (auto& setting : final_eq)
-						cout << setting << " ";
-					cout << endl;
-				} else {
-					cout << "Transformed to:\n";
-					auto negative_curve = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
+	// Frequency analysis of one microphone against one speaker
+	auto analyzeSpeaker = [&] (size_t z, size_t i, const vector<short>& data, const vector<vector<double>>& impulse_responses, const vector<complex<double>>& multitone_spectrum) {
+		auto& mic_ip = mic_ips.at(z);
+		ScopedTimer speaker_timer("analyse speaker", speaker_ips.at(i), mic_ip);
 
-					if (Base::config().get<bool>("enable_hardware_profile")) {
-						response = nac::toDecibel(response);
+		size_t sound_start = getSegment(i).first;
+		size_t sound_stop = getSegment(i).second;
 
-						auto speaker_profile = Base::system().getSpeakerProfile().invert();
-						auto mic_profile = Base::system().getMicrophoneProfile().invert();
+		vector<double> dbs;
+		vector<double> final_eq;
 
-						response = nac::applyProfiles(response, speaker_profile, mic_profile);
+		if (run_white_noise || run_impulse_responses || run_multitone) {
+			FFTOutput response;
 
-						// Revert back to energy
-						response = nac::toLinear(response);
+			if (run_impulse_responses)
+				response = nac::getResponseSpectrum(impulse_responses.at(i), 48000);
+			else if (run_multitone)
+				response = multitone->getResponse(multitone_spectrum, i);
+			else
+				response = getWhiteResponse(data, sound_start, sound_stop);
 
-						cout << "After hardware profile:\n";
-						negative_curve = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
-					}
+			//response = nac::toDecibel(response);
 
-					// Negative response to get change curve
-					vector<double> change_eq;
+			dbs = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
+			Base::system().getSpeaker(mic_ip).setdBType(DB_TYPE_POWER);
 
-					for (auto& value : negative_curve)
-						change_eq.push_back(value * (-1));
+			// Calculate speaker EQ
+			if (Base::config().get<bool>("simulate_eq_settings")) {
+				if (run_impulse_responses || run_multitone)
+					final_eq = nac::findSimulatedEQSettings(response, Base::system().getSpeakerProfile().getFilter());
+				else
+					final_eq = nac::findSimulatedEQSettings(data, Base::system().getSpeakerProfile().getFilter(), sound_start, sound_stop);
 
-					final_eq = change_eq;
-				}
+				cout << "Returned final_eq: ";
+				for (auto& setting : final_eq)
+					cout << setting << " ";
+				cout << endl;
 			} else {
-				// Calculate FFT for 9 band as well
-				auto db_linears = getFFT9(data, sound_start, sound_stop);
+				cout << "Transformed to:\n";
+				auto negative_curve = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
 
-				for (auto& db_linear : db_linears) {
-					double db = 20 * log10(db_linear);
+				if (Base::config().get<bool>("enable_hardware_profile")) {
+					response = nac::toDecibel(response);
 
-					dbs.push_back(db);
+					auto speaker_profile = Base::system().getSpeakerProfile().invert();
+					auto mic_profile = Base::system().getMicrophoneProfile().invert();
+
+					response = nac::applyProfiles(response, speaker_profile, mic_profile);
+
+					// Revert back to energy
+					response = nac::toLinear(response);
+
+					cout << "After hardware profile:\n";
+					negative_curve = nac::fitBands(response, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
 				}
 
-				// How much does this microphone get per frequency?
-				cout << "Microphone (" << mic_ip << ") gets from " << speaker_ips.at(i) << ":\n";
-				for (size_t j = 0; j < dbs.size(); j++)
-					cout << "Frequency " << g_frequencies.at(j) << "\t " << dbs.at(j) << " dB\n";
+				// Negative response to get change curve
+				vector<double> change_eq;
+
+				for (auto& value : negative_curve)
+					change_eq.push_back(value * (-1));
 
-				// Calculate correction EQ
-				auto eq = getSoundImageCorrection(dbs);
+				final_eq = change_eq;
+			}
+		} else {
+			// Calculate FFT for 9 band as well
+			auto db_linears = getFFT9(data, sound_start, sound_stop);
 
-				cout << "Which gives the correction EQ of:\n";
-				for (size_t j = 0; j < eq.size(); j++)
-					cout << "Frequency " << g_frequencies.at(j) << "\t " << eq.at(j) << " dB\n";
+			for (auto& db_linear : db_linears) {
+				double db = 20 * log10(db_linear);
 
-				final_eq = eq;
+				dbs.push_back(db);
 			}
 
-			//new_eqs.at(i) = final_eq;
-			wanted_eqs.at(z).at(i) = final_eq;
+			// How much does this microphone get per frequency?
+			cout << "Microphone (" << mic_ip << ") gets from " << speaker_ips.at(i) << ":\n";
+			for (size_t j = 0; j < dbs.size(); j++)
+				cout << "Frequency " << g_frequencies.at(j) << "\t " << dbs.at(j) << " dB\n";
 
-			double sound_level = getRMS(data, sound_start, sound_stop);
+			// Calculate correction EQ
+			auto eq = getSoundImageCorrection(dbs);
+
+			cout << "Which gives the correction EQ of:\n";
+			for (size_t j = 0; j < eq.size(); j++)
+				cout << "Frequency " << g_frequencies.at(j) << "\t " << eq.at(j) << " dB\n";
+
+			final_eq = eq;
+		}
+
+		responses.setWantedEQ(z, i, final_eq);
+
+		double sound_level;
+
+		if (run_impulse_responses) {
+			sound_level = nac::getResponseLevel(impulse_responses.at(i), run_sweeps ? sweep : mls_signal);
+		} else if (run_multitone) {
+			sound_level = multitone->getLevel(multitone_spectrum, i);
+		} else {
+			sound_level = getRMS(data, sound_start, sound_stop);
 			sound_level = 20 * log10(sound_level / (double)SHRT_MAX);
+		}
+
+		#pragma omp critical
+		{
+			Base::system().getSpeaker(mic_ip).setFrequencyResponseFrom(speaker_ips.at(i), dbs);
+			Base::system().getSpeaker(mic_ip).setSoundLevelFrom(speaker_ips.at(i), sound_level);
+
+			responses.setResponse(z, i, dbs, Base::system().getSpeaker(mic_ip).getdBType());
+			responses.setLevel(z, i, sound_level);
 
-			#pragma omp critical
-			{
-				Base::system().getSpeaker(mic_ip).setFrequencyResponseFrom(speaker_ips.at(i), dbs);
-				Base::system().getSpeaker(mic_ip).setSoundLevelFrom(speaker_ips.at(i), sound_level);
+			Base::results().add(ResultsStore::getKey(run, room, speaker_ips.at(i), mic_ip, "bands"), dbs);
+			Base::results().add(ResultsStore::getKey(run, room, speaker_ips.at(i), mic_ip, "wanted_eq"), final_eq);
+			Base::results().add(ResultsStore::getKey(run, room, speaker_ips.at(i), mic_ip, "level"), vector<double>{ sound_level });
+		}
+	};
+
+	size_t analysed = 0;
+
+	// Frequency analysis of one microphone against every speaker
+	auto analyze = [&] (size_t z) {
+		auto& mic_ip = mic_ips.at(z);
+
+		JobExecutor::progress("analysing", mic_ip, 40 + 30.0 * analysed++ / mic_ips.size());
+		ScopedTimer timer("analyse", "", mic_ip);
+
+		vector<short> data;
+
+		{
+			ScopedTimer read_timer("WavReader::read", "", mic_ip);
+			WavReader::read("results/cap" + mic_ip + ".wav", data);
+		}
+
+		Base::results().add(ResultsStore::getKey(run, room, "", mic_ip, "capture"), data);
+
+		vector<vector<double>> impulse_responses;
+
+		if (run_sweeps) {
+			// One deconvolution gives the responses of every speaker
+			auto deconvolved = nac::deconvolve(data, inverse);
+			size_t search = stagger * 48000 / 2;
+
+			impulse_responses = nac::getImpulseResponses(deconvolved, sweep.size(), offsets, search, pre_delay, ir_length);
+		} else if (run_mls) {
+			// Skip the first period, the room isn't in steady state and the device may start late
+			for (auto& offset : offsets) {
+				auto impulse_response = mls->getImpulseResponse(data, offset + mls->size(), mls_periods - 1, mls_level, pre_delay);
+				impulse_response.resize(ir_length);
+
+				impulse_responses.push_back(impulse_response);
+			}
+		}
+
+		// Later reflections are faded out by the window
+		for (auto& impulse_response : impulse_responses)
+			nac::windowImpulseResponse(impulse_response, pre_delay, ir_fade);
+
+		// One FFT of the averaged periods holds the tones of every speaker
+		vector<complex<double>> multitone_spectrum;
+
+		if (run_multitone)
+			multitone_spectrum = multitone->getSpectrum(data, idle * 48000 + multitone->size(), multitone_periods - 1);
+
+		#pragma omp parallel for copyin(g_session)
+		for (size_t i = 0; i < speaker_ips.size(); i++)
+			analyzeSpeaker(z, i, data, impulse_responses, multitone_spectrum);
+	};
+
+	// Every speaker as soon as its part of every recording is in
+	auto analyseWhileMeasuring = [&] () {
+		for (size_t i = 0; i < speaker_ips.size(); i++) {
+			JobExecutor::progress("analysing", speaker_ips.at(i), 40 + 30.0 * i / speaker_ips.size());
+			bool complete = true;
+
+			#pragma omp parallel for copyin(g_session)
+			for (size_t z = 0; z < mic_ips.size(); z++) {
+				vector<short> data;
+
+				if (Base::captures().waitFor(mic_ips.at(z), getSegment(i).second, data)) {
+					analyzeSpeaker(z, i, data, {}, {});
+				} else {
+					#pragma omp atomic write
+					complete = false;
+				}
+			}
+
+			if (!complete)
+				throw runtime_error("capture streams ended before " + speaker_ips.at(i) + " was recorded");
+		}
+	};
+
+	if (analyse_while_measuring) {
+		// The record commands tell the capture streams what to expect, so they are made before anything waits for them
+		vector<string> measure_ips;
+		auto scripts = createFrequencyResponseScripts(speaker_ips, mic_ips, sequential_file, sequential_play, measure_ips);
+
+		measure = [&] () {
+			ScopedTimer timer("playback");
+			Base::system().runScript(measure_ips, scripts);
+		};
+
+		auto* session = g_session;
+		exception_ptr measure_error;
+
+		thread measurement([&measure, &measure_error, session] () {
+			g_session = session;
+
+			try {
+				measure();
+			} catch (...) {
+				measure_error = current_exception();
 			}
+		});
+
+		try {
+			analyseWhileMeasuring();
+		} catch (...) {
+			// The scripts can't be stopped halfway, and a cancelled job or failed script explains stalled streams better
+			measurement.join();
+
+			if (measure_error)
+				rethrow_exception(measure_error);
+
+			throw;
 		}
 
-		// Add this to further calculations when we have all the information
-		//wanted_eqs.at(z) = new_eqs;
+		measurement.join();
+
+		if (measure_error)
+			rethrow_exception(measure_error);
+
+		// The same files as fetched recordings, for the scores and the archive
+		Base::system().getRecordings(mic_ips);
+
+		for (auto& mic_ip : mic_ips) {
+			vector<short> data;
+			WavReader::read("results/cap" + mic_ip + ".wav", data);
+
+			Base::results().add(ResultsStore::getKey(run, room, "", mic_ip, "capture"), data);
+		}
+	} else if (new_recordings) {
+		// Start analysing every microphone as soon as its recording has arrived
+		Base::system().getRecordings(mic_ips, analyze);
+	} else {
+		for (size_t z = 0; z < mic_ips.size(); z++)
+			analyze(z);
 	}
 
+	JobExecutor::progress("setting EQ", "", 70);
+
 	// Weight data against profile and microphones
-	auto final_eqs = weightEQs(speaker_ips, mic_ips, wanted_eqs);
+	vector<vector<double>> final_eqs;
+
+	{
+		ScopedTimer timer("weightEQs");
+		final_eqs = responses.weightEQs();
+	}
 
 	// Set new EQs
 	for (size_t j = 0; j < speaker_ips.size(); j++) {
+		cout << "Speaker " << speaker_ips.at(j) << " gets weighted EQ ";
+		for_each(final_eqs.at(j).begin(), final_eqs.at(j).end(), [] (double value) { cout << value << " "; });
+		cout << endl;
+
 		// Add new EQ
 		Base::system().getSpeaker(speaker_ips.at(j)).setNextEQ(final_eqs.at(j), 0);
 
@@ -1379,21 +1842,31 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 	if (!ignore_new_eq_settings)
 		setEQ(speaker_ips, TYPE_BEST_EQ);
 
+	for (auto& speaker_ip : speaker_ips)
+		Base::results().add(ResultsStore::getKey(run, room, speaker_ip, "", "eq"), Base::system().getSpeaker(speaker_ip).getBestEQ());
+
 	if (run_validation) {
+		JobExecutor::progress("validating", "", 75);
+
 		// Play white noise from all speakers to check sound image & collect the recordings
 		runTestSoundImage(speaker_ips, mic_ips, Base::config().get<string>("white_noise"));
 		Base::system().getRecordings(mic_ips);
 
 		// See calibration score before calibrating
 		showCalibrationScore(mic_ips, false);
+		storeCalibrationScores(run, room, mic_ips, "score_after");
+
+		writeWhiteNoiseFiles("after", mic_ips, timestamp);
+		moveFileMATLAB("after", mic_ips);
 
-		writeWhiteNoiseFiles("after", timestamp);
-		writeEQSettings("after", timestamp, speaker_ips);
-		moveToMATLAB(timestamp, mic_ips);
+		auto eqs = writeEQSettings("after", timestamp, speaker_ips);
+		Base::archive().addText("../matlab/eqs", eqs);
 	}
 
 	if (Base::config().get<bool>("enable_sound_level_adjustment")) {
-		setCalibratedSoundLevel(speaker_ips, mic_ips, adjusted_final_gain, false);
+		JobExecutor::progress("setting sound level", "", 85);
+
+		setCalibratedSoundLevel(speaker_ips, mic_ips, responses, adjusted_final_gain, false);
 
 		if (run_validation) {
 			runTestSoundImage(speaker_ips, mic_ips, Base::config().get<string>("white_noise"));
@@ -1412,7 +1885,7 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 		setEQ(speaker_ips, TYPE_BEST_EQ);
 
 		if (Base::config().get<bool>("enable_sound_level_adjustment"))
-			setCalibratedSoundLevel(speaker_ips, mic_ips, adjusted_final_gain, true);
+			setCalibratedSoundLevel(speaker_ips, mic_ips, responses, adjusted_final_gain, true);
 	}
 
 	// Write APO settings
@@ -1425,14 +1898,225 @@ void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<str
 	// Check desired gain for every microphone
 	//setCalibratedSoundLevel(speaker_ips, mic_ips, adjusted_final_gain);
 
-	resetEverything(mic_ips);
-	enableAudioSystem(all_ips);
+	// What the speakers run with in the end, verification expects to hear it
+	for (auto& speaker_ip : speaker_ips)
+		Base::results().add(ResultsStore::getKey(run, room, speaker_ip, "", "applied_eq"), Base::system().getSpeaker(speaker_ip).getBestEQ());
+
+	// Last, a listed run is complete
+	Base::results().addRun(run, { static_cast<double>(type), static_cast<double>(speaker_ips.size()), static_cast<double>(mic_ips.size()) });
+
+	restoreSpeakers(mic_ips, all_ips);
+}
+
+void Handle::checkSoundImage(const vector<string>& speaker_ips, const vector<string>& mic_ips, const vector<double>& gains, bool factor_calibration, int type) {
+	try {
+		runSoundImage(speaker_ips, mic_ips, gains, factor_calibration, type);
+	} catch (const JobCancelled&) {
+		cout << "Sound image cancelled, restoring speakers\n";
+
+		vector<string> all_ips(speaker_ips);
+		all_ips.insert(all_ips.end(), mic_ips.begin(), mic_ips.end());
+
+		// Cancelled between stages, so the speakers are idle
+		restoreSpeakers(all_ips, all_ips);
+
+		throw;
+	}
+}
+
+// Band levels of every speaker at every microphone from a single multitone capture, [mic][speaker]
+static vector<vector<vector<double>>> measureMultitoneBands(const vector<string>& speaker_ips, const vector<string>& mic_ips, size_t periods) {
+	auto bands = Base::system().getSpeakerProfile().getSpeakerEQ().first;
+	nac::Multitone multitone(Base::config().get<int>("multitone_order"), speaker_ips.size(), bands, Base::config().get<double>("dsp_octave_width"), Base::config().get<double>("multitone_level"));
+
+	vector<string> files;
+	vector<string> local_files;
+	double duration = 0;
+
+	for (size_t i = 0; i < speaker_ips.size(); i++) {
+		auto signal = multitone.createSignal(i, periods);
+		duration = signal.size() / 48000.0;
+
+		files.push_back(getSignalFile(MULTITONE_FILE + speaker_ips.at(i)));
+		local_files.push_back("results/" + files.back());
+
+		WavReader::write(local_files.back(), signal);
+	}
+
+	Base::system().sendFiles(speaker_ips, local_files, "/tmp/", true);
+	runStaggeredScripts(speaker_ips, mic_ips, files, duration, 0);
+
+	auto idle = Base::config().get<int>("idle_time");
+	vector<vector<vector<double>>> levels(mic_ips.size());
+
+	Base::system().getRecordings(mic_ips, [&] (size_t z) {
+		vector<short> data;
+		WavReader::read("results/cap" + mic_ips.at(z) + ".wav", data);
+
+		auto spectrum = multitone.getSpectrum(data, idle * 48000 + multitone.size(), periods - 1);
+
+		for (size_t i = 0; i < speaker_ips.size(); i++)
+			levels.at(z).push_back(nac::fitBands(multitone.getResponse(spectrum, i), Base::system().getSpeakerProfile().getSpeakerEQ(), false).first);
+	});
+
+	return levels;
+}
+
+// Newest band levels of a speaker at a microphone in the results store and the EQ it got from that run
+static bool getStoredCalibration(const string& speaker_ip, const string& mic_ip, vector<double>& bands, vector<double>& eq) {
+	auto runs = Base::results().getRuns();
+	auto room = Base::config().get<string>("results_room");
+
+	for (auto run = runs.rbegin(); run != runs.rend(); run++)
+		if (Base::results().get(ResultsStore::getKey(*run, room, speaker_ip, mic_ip, "bands"), bands) &&
+			Base::results().get(ResultsStore::getKey(*run, room, speaker_ip, "", "applied_eq"), eq))
+			return true;
+
+	return false;
+}
+
+static double getMedian(vector<double> values) {
+	if (values.empty())
+		return 0;
+
+	auto median = values.begin() + values.size() / 2;
+	nth_element(values.begin(), median, values.end());
+
+	return *median;
+}
+
+/*
+	A speaker has drifted if any of its bands moved more than tolerance dB at any microphone.
+	The median difference of every microphone and then of every speaker is removed first,
+	that's the difference between the test signals and the gain settings, not the room.
+*/
+static vector<bool> findDrifted(const vector<vector<vector<double>>>& measured, const vector<vector<vector<double>>>& expected, double tolerance) {
+	size_t num_mics = measured.size();
+	size_t num_speakers = measured.front().size();
+
+	// [mic][speaker][band]
+	auto differences = measured;
+
+	for (size_t z = 0; z < num_mics; z++)
+		for (size_t i = 0; i < num_speakers; i++)
+			for (size_t j = 0; j < differences.at(z).at(i).size(); j++)
+				differences.at(z).at(i).at(j) -= expected.at(z).at(i).at(j);
+
+	for (auto& mic : differences) {
+		vector<double> all;
+
+		for (auto& speaker : mic)
+			all.insert(all.end(), speaker.begin(), speaker.end());
+
+		double offset = getMedian(all);
+
+		for (auto& speaker : mic)
+			for (auto& difference : speaker)
+				difference -= offset;
+	}
+
+	vector<bool> drifted(num_speakers, false);
+
+	for (size_t i = 0; i < num_speakers; i++) {
+		vector<double> all;
+
+		for (auto& mic : differences)
+			all.insert(all.end(), mic.at(i).begin(), mic.at(i).end());
+
+		double offset = getMedian(all);
+		double worst = 0;
+
+		for (auto& difference : all)
+			worst = max(worst, abs(difference - offset));
+
+		cout << "Speaker " << i << " is at most " << worst << " dB off\n";
+
+		drifted.at(i) = worst > tolerance;
+	}
+
+	return drifted;
+}
+
+vector<string> Handle::verifySoundImage(const vector<string>& speaker_ips, const vector<string>& mic_ips, const vector<double>& gains, bool factor_calibration, int type) {
+	// A recalibration is traced as part of this
+	TraceRun trace_run("verify_" + getRunID());
+
+	// What the microphones should hear with the current EQs
+	vector<vector<vector<double>>> expected(mic_ips.size());
+
+	for (size_t z = 0; z < mic_ips.size(); z++) {
+		for (auto& speaker_ip : speaker_ips) {
+			vector<double> bands;
+			vector<double> eq;
+
+			if (!getStoredCalibration(speaker_ip, mic_ips.at(z), bands, eq) || bands.size() != eq.size()) {
+				cout << "Warning: " << speaker_ip << " has not been calibrated with " << mic_ips.at(z) << ", calibrating everything\n";
+
+				checkSoundImage(speaker_ips, mic_ips, gains, factor_calibration, type);
+				return speaker_ips;
+			}
+
+			for (size_t j = 0; j < bands.size(); j++)
+				bands.at(j) += eq.at(j);
+
+			expected.at(z).push_back(bands);
+		}
+	}
+
+	vector<string> all_ips(speaker_ips);
+	all_ips.insert(all_ips.end(), mic_ips.begin(), mic_ips.end());
+
+	JobExecutor::progress("verifying", "", 5);
+
+	// Speakers keep their EQs and gains, dspd is not restarted
+	CommandBatch setup;
+	setup.add(all_ips, "systemctl stop audio*; wait\n");
+	setTestSpeakerSettings(mic_ips, setup, true);
+	setup.run();
+
+	vector<string> drifted_ips;
+	vector<string> kept_ips;
+
+	try {
+		auto measured = measureMultitoneBands(speaker_ips, mic_ips, Base::config().get<size_t>("verify_periods"));
+		auto drifted = findDrifted(measured, expected, Base::config().get<double>("drift_tolerance"));
+
+		for (size_t i = 0; i < speaker_ips.size(); i++)
+			(drifted.at(i) ? drifted_ips : kept_ips).push_back(speaker_ips.at(i));
+	} catch (const JobCancelled&) {
+		restoreSpeakers(mic_ips, all_ips);
+
+		throw;
+	}
+
+	cout << drifted_ips.size() << " of " << speaker_ips.size() << " speakers have drifted\n";
+
+	if (drifted_ips.empty()) {
+		restoreSpeakers(mic_ips, all_ips);
+
+		return drifted_ips;
+	}
+
+	JobExecutor::progress("recalibrating", "", 20);
+
+	// Stores a new run, the next verification compares against it for these speakers
+	try {
+		checkSoundImage(drifted_ips, mic_ips, gains, factor_calibration, type);
+	} catch (...) {
+		restoreSpeakers({}, kept_ips);
+
+		throw;
+	}
+
+	// Quiet until now so they don't disturb the calibration
+	restoreSpeakers({}, kept_ips);
+
+	return drifted_ips;
 }
 
 void Handle::resetIPs(const vector<string>& ips) {
 	// Reset speakers & enable audio system
-	resetEverything(ips);
-	enableAudioSystem(ips);
+	restoreSpeakers(ips, ips);
 }
 
 void Handle::setEQStatus(const vector<string>& ips, bool status) {
@@ -1457,10 +2141,28 @@ void Handle::setSoundEffects(const std::vector<std::string> &ips, bool status) {
 	*/
 }
 
-static void plotFFT(const vector<short>& samples, size_t start, size_t stop) {
-	//vector<short> real(samples.begin() + start, samples.begin() + stop);
+// Testing captures are either noise or one sweep from getSweepSettings(), see testing_sweep
+static FFTOutput getTestingResponse(const vector<short>& samples, size_t start, size_t stop) {
+	if (!Base::config().get<bool>("testing_sweep"))
+		return nac::doFFT(samples, start, stop);
+
+	auto settings = nac::getSweepSettings();
+	auto sweep = nac::createSweep(settings);
+	auto deconvolved = nac::deconvolve(samples, nac::createInverseFilter(sweep, settings));
 
-	auto before = nac::doFFT(samples, start, stop);
+	size_t pre_delay = settings.fs_ / 1000;
+	size_t length = lround(Base::config().get<double>("sweep_window_ms") / 1000 * settings.fs_);
+	size_t fade = min<size_t>(lround(Base::config().get<double>("sweep_window_fade_ms") / 1000 * settings.fs_), length / 2);
+
+	// The sweep can start anywhere in the file
+	auto impulse_response = nac::getImpulseResponses(deconvolved, sweep.size(), { 0 }, deconvolved.size(), pre_delay, length).front();
+	nac::windowImpulseResponse(impulse_response, pre_delay, fade);
+
+	return nac::getResponseSpectrum(impulse_response, settings.fs_);
+}
+
+static void plotFFT(const vector<short>& samples, size_t start, size_t stop) {
+	auto before = getTestingResponse(samples, start, stop);
 	//before = nac::toDecibel(before);
 	auto eq = nac::fitBands(before, Base::system().getSpeakerProfile().getSpeakerEQ(), false).first;
 }
@@ -1469,14 +2171,18 @@ static vector<short> plotFFTFile(const string& file, size_t& start, size_t& stop
 	vector<short> samples;
 	WavReader::read(file, samples);
 
-	if (stop > samples.size()) {
-		// This is usually due to using sweeps instead of noise
-		// TODO: Add sweeps and noise as an actual option
-		cout << "WARNING: Using different start/stop since stop is longer than the file\n";
-		start = 2 * 48000;
+	// Sweeps are found by deconvolution, so the whole file is used
+	if (Base::config().get<bool>("testing_sweep")) {
+		start = 0;
 		stop = samples.size();
 	}
 
+	if (stop > samples.size()) {
+		cout << "Error: " << file << " is shorter than the analysed part, set testing_sweep for sweep captures\n";
+
+		throw exception();
+	}
+
 	if (plot)
 		plotFFT(samples, start, stop);
 
@@ -1500,8 +2206,12 @@ void Handle::testing() {
 
 		vector<double> final_eq;
 
-		if (calc_eq)
-			final_eq = nac::findSimulatedEQSettings(before_samples, Base::system().getSpeakerProfile().getFilter(), start, stop);
+		if (calc_eq) {
+			if (Base::config().get<bool>("testing_sweep"))
+				final_eq = nac::findSimulatedEQSettings(getTestingResponse(before_samples, start, stop), Base::system().getSpeakerProfile().getFilter());
+			else
+				final_eq = nac::findSimulatedEQSettings(before_samples, Base::system().getSpeakerProfile().getFilter(), start, stop);
+		}
 
 		if (Base::config().get<bool>("enable_customer_profile")) {
 			auto customer_eq = Base::config().getAll<double>("customer_profile");
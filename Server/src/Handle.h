@@ -7,7 +7,6 @@
 #include <array>
 
 using PlacementOutput = std::vector<std::tuple<std::string, std::vector<double>, std::vector<std::pair<std::string, double>>>>;
-using MicWantedEQ = std::vector<std::vector<std::vector<double>>>;
 using SSHOutput = std::vector<std::pair<std::string, std::vector<std::string>>>;
 using FactorData = std::vector<std::vector<std::vector<std::vector<double>>>>;
 
@@ -16,6 +15,8 @@ public:
 	static PlacementOutput runLocalization(const std::vector<std::string>& ips, bool force_update);
 	static std::vector<bool> checkSpeakersOnline(const std::vector<std::string>& ips);
 	static void checkSoundImage(const std::vector<std::string>& speakers, const std::vector<std::string>& mics, const std::vector<double>& gains, bool factor_calibration, int type);
+	// Quick check against the last calibration, only drifted speakers are calibrated again and returned
+	static std::vector<std::string> verifySoundImage(const std::vector<std::string>& speakers, const std::vector<std::string>& mics, const std::vector<double>& gains, bool factor_calibration, int type);
 	//static void setBestEQ(const std::vector<std::string>& speakers, const std::vector<std::string>& mics);
 	static void setEQStatus(const std::vector<std::string>& ips, bool status);
 	static void setSoundEffects(const std::vector<std::string>& ips, bool status);
@@ -0,0 +1,317 @@
+#include "JobExecutor.h"
+#include "Packet.h"
+#include "Base.h"
+#include "NetworkCommunication.h"
+
+#include <iostream>
+#include <set>
+#include <algorithm>
+
+using namespace std;
+
+// Finished jobs kept around for status requests
+static const size_t MAX_FINISHED_JOBS = 64;
+
+thread_local JobExecutor::Job* JobExecutor::current_ = nullptr;
+
+const char* JobCancelled::what() const noexcept {
+	return "job cancelled";
+}
+
+JobExecutor::JobExecutor() :
+	thread_(&JobExecutor::run, this) {
+}
+
+JobExecutor::~JobExecutor() {
+	{
+		lock_guard<mutex> guard(mutex_);
+		stop_ = true;
+
+		// Whatever is running stops at its next progress report, queued jobs are never started
+		for (auto& job : jobs_)
+			job.second->cancelled_ = true;
+	}
+
+	condition_.notify_all();
+	thread_.join();
+}
+
+int JobExecutor::submit(int socket, unsigned char header, const string& name, const shared_ptr<Session>& session, const vector<string>& ips, const Work& work) {
+	auto job = make_shared<Job>();
+	job->socket_ = socket;
+	job->header_ = header;
+	job->name_ = name;
+	job->work_ = work;
+	job->session_ = session;
+	job->ips_ = ips;
+	job->cancelled_ = false;
+	job->status_.stage_ = "queued";
+
+	{
+		lock_guard<mutex> guard(mutex_);
+		job->id_ = next_id_++;
+
+		queue_.push_back(job);
+		jobs_[job->id_] = job;
+		schedule_ = true;
+	}
+
+	condition_.notify_all();
+
+	cout << "Job " << job->id_ << " (" << name << ") queued\n";
+
+	return job->id_;
+}
+
+bool JobExecutor::cancel(int id) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = jobs_.find(id);
+
+	if (iterator == jobs_.end())
+		return false;
+
+	auto& job = iterator->second;
+
+	{
+		lock_guard<mutex> status_guard(job->status_mutex_);
+
+		if (job->status_.state_ != JOB_QUEUED && job->status_.state_ != JOB_RUNNING)
+			return false;
+	}
+
+	job->cancelled_ = true;
+	schedule_ = true;
+
+	// Queued jobs are reported right away
+	condition_.notify_all();
+
+	return true;
+}
+
+bool JobExecutor::getStatus(int id, JobStatus& status) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = jobs_.find(id);
+
+	if (iterator == jobs_.end())
+		return false;
+
+	lock_guard<mutex> status_guard(iterator->second->status_mutex_);
+	status = iterator->second->status_;
+
+	return true;
+}
+
+bool JobExecutor::hasJobs(const Session* session) {
+	lock_guard<mutex> guard(mutex_);
+	auto isSession = [session] (const shared_ptr<Job>& job) { return job->session_.get() == session; };
+
+	return any_of(queue_.begin(), queue_.end(), isSession) || any_of(running_.begin(), running_.end(), isSession);
+}
+
+void JobExecutor::progress(const string& stage, const string& speaker, double percent) {
+	auto* job = current_;
+
+	if (job == nullptr)
+		return;
+
+	if (job->cancelled_)
+		throw JobCancelled();
+
+	JobStatus status;
+
+	{
+		lock_guard<mutex> guard(job->status_mutex_);
+		job->status_.stage_ = stage;
+		job->status_.speaker_ = speaker;
+
+		if (percent >= 0)
+			job->status_.percent_ = percent;
+
+		status = job->status_;
+	}
+
+	cout << "Job " << job->id_ << ": " << stage << (speaker.empty() ? "" : " " + speaker) << " (" << status.percent_ << " %)\n";
+
+	Packet packet;
+	packet.addHeader(PACKET_JOB_PROGRESS);
+	packet.addInt(job->id_);
+	packet.addString(status.stage_);
+	packet.addString(status.speaker_);
+	packet.addFloat(status.percent_);
+	packet.finalize();
+
+	Base::network().addOutgoingPacket(job->socket_, packet);
+}
+
+void JobExecutor::sendStatus(const Job& job, const JobStatus& status) {
+	Packet packet;
+	packet.addHeader(PACKET_JOB_STATUS);
+	packet.addInt(job.id_);
+	packet.addInt(status.state_);
+	packet.addString(status.stage_);
+	packet.addString(status.speaker_);
+	packet.addFloat(status.percent_);
+	packet.finalize();
+
+	Base::network().addOutgoingPacket(job.socket_, packet);
+}
+
+JobStatus JobExecutor::finish(Job& job, int state) {
+	JobStatus status;
+
+	{
+		lock_guard<mutex> guard(job.status_mutex_);
+		job.status_.state_ = state;
+
+		if (state == JOB_DONE)
+			job.status_.percent_ = 100;
+
+		status = job.status_;
+	}
+
+	// Forget the oldest finished jobs, older jobs can still be running
+	lock_guard<mutex> guard(mutex_);
+	auto isFinished = [] (const pair<const int, shared_ptr<Job>>& entry) {
+		lock_guard<mutex> status_guard(entry.second->status_mutex_);
+
+		return entry.second->status_.state_ >= JOB_DONE;
+	};
+
+	size_t finished = count_if(jobs_.begin(), jobs_.end(), isFinished);
+
+	for (auto iterator = jobs_.begin(); iterator != jobs_.end() && finished > MAX_FINISHED_JOBS; ) {
+		if (isFinished(*iterator)) {
+			iterator = jobs_.erase(iterator);
+			finished--;
+		} else {
+			iterator++;
+		}
+	}
+
+	return status;
+}
+
+// Called with mutex_ held
+void JobExecutor::start() {
+	set<Session*> sessions;
+	set<string> ips;
+
+	auto claim = [&sessions, &ips] (const Job& job) {
+		sessions.insert(job.session_.get());
+		ips.insert(job.ips_.begin(), job.ips_.end());
+	};
+
+	for (auto& job : running_)
+		claim(*job);
+
+	for (auto iterator = queue_.begin(); iterator != queue_.end(); ) {
+		auto job = *iterator;
+
+		// Cancelled jobs don't touch anything, let them report it
+		if (!job->cancelled_) {
+			bool available = sessions.count(job->session_.get()) == 0 && none_of(job->ips_.begin(), job->ips_.end(), [&ips] (const string& ip) { return ips.count(ip) > 0; });
+
+			// Claimed either way, later jobs can't overtake a waiting one they share something with
+			claim(*job);
+
+			if (!available) {
+				iterator++;
+
+				continue;
+			}
+		}
+
+		iterator = queue_.erase(iterator);
+		running_.push_back(job);
+		job->thread_ = thread(&JobExecutor::execute, this, job);
+	}
+}
+
+void JobExecutor::run() {
+	unique_lock<mutex> lock(mutex_);
+
+	while (true) {
+		condition_.wait(lock, [this] () { return stop_ || schedule_; });
+		schedule_ = false;
+
+		// These have returned from execute() already
+		for (auto& job : finished_) {
+			job->thread_.join();
+			running_.remove(job);
+		}
+
+		finished_.clear();
+
+		if (stop_) {
+			if (running_.empty())
+				break;
+
+			continue;
+		}
+
+		start();
+	}
+}
+
+void JobExecutor::execute(shared_ptr<Job> job) {
+	if (job->cancelled_) {
+		sendStatus(*job, finish(*job, JOB_CANCELLED));
+	} else {
+		{
+			lock_guard<mutex> guard(job->status_mutex_);
+			job->status_.state_ = JOB_RUNNING;
+			job->status_.stage_ = "running";
+		}
+
+		cout << "Job " << job->id_ << " (" << job->name_ << ") started\n";
+
+		// The reply is the normal one with the job ID after the header
+		Packet packet;
+		packet.addHeader(job->header_);
+		packet.addInt(job->id_);
+
+		g_session = job->session_.get();
+		current_ = job.get();
+		int state = JOB_DONE;
+
+		try {
+			job->work_(packet);
+		} catch (const JobCancelled&) {
+			state = JOB_CANCELLED;
+		} catch (const exception& error) {
+			cout << "Job " << job->id_ << " failed: " << error.what() << endl;
+
+			state = JOB_FAILED;
+		} catch (...) {
+			// Anything else would terminate the server with every other session
+			cout << "Job " << job->id_ << " failed with an unknown exception\n";
+
+			state = JOB_FAILED;
+		}
+
+		current_ = nullptr;
+		g_session = nullptr;
+
+		cout << "Job " << job->id_ << " (" << job->name_ << ") " << (state == JOB_DONE ? "done" : state == JOB_CANCELLED ? "cancelled" : "failed") << endl;
+
+		auto status = finish(*job, state);
+
+		if (state == JOB_DONE) {
+			packet.finalize();
+			Base::network().addOutgoingPacket(job->socket_, packet);
+		} else {
+			sendStatus(*job, status);
+		}
+	}
+
+	{
+		lock_guard<mutex> guard(mutex_);
+		finished_.push_back(job);
+		schedule_ = true;
+
+		// Kept for status requests, not the session which can be evicted once idle
+		job->session_.reset();
+	}
+
+	condition_.notify_all();
+}
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef JOB_EXECUTOR_H
+#define JOB_EXECUTOR_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+class Packet;
+class Session;
+
+enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_CANCELLED,
+	JOB_FAILED
+};
+
+struct JobStatus {
+	int state_ = JOB_QUEUED;
+	std::string stage_;
+	std::string speaker_;
+	double percent_ = 0;
+};
+
+// Thrown by JobExecutor::progress() when the running job has been cancelled
+class JobCancelled : public std::exception {
+public:
+	const char* what() const noexcept override;
+};
+
+/*
+	Runs long requests off the packet thread. The client gets the job ID right away, progress
+	packets while it runs and the normal reply with the ID after the header when it's done, or
+	a status packet if it was cancelled or failed.
+
+	Every job runs on a thread of its own with its session set, see Base. Jobs of different
+	sessions on different speakers run at the same time, anything else waits for the earlier
+	jobs it shares a session or speaker with so jobs never overtake each other.
+*/
+class JobExecutor {
+public:
+	using Work = std::function<void(Packet&)>;
+
+	JobExecutor();
+	~JobExecutor();
+
+	int submit(int socket, unsigned char header, const std::string& name, const std::shared_ptr<Session>& session, const std::vector<std::string>& ips, const Work& work);
+	bool cancel(int id);
+	bool getStatus(int id, JobStatus& status);
+
+	// Queued or running jobs of the session
+	bool hasJobs(const Session* session);
+
+	// Reports to the client of the job running on this thread, throws JobCancelled if it was cancelled
+	static void progress(const std::string& stage, const std::string& speaker = "", double percent = -1);
+
+private:
+	struct Job {
+		int id_;
+		int socket_;
+		unsigned char header_;
+		std::string name_;
+		Work work_;
+		std::shared_ptr<Session> session_;
+		std::vector<std::string> ips_;
+		std::atomic<bool> cancelled_;
+		std::thread thread_;
+
+		std::mutex status_mutex_;
+		JobStatus status_;
+	};
+
+	void run();
+	void start();
+	void execute(std::shared_ptr<Job> job);
+	JobStatus finish(Job& job, int state);
+
+	static void sendStatus(const Job& job, const JobStatus& status);
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::deque<std::shared_ptr<Job>> queue_;
+	std::list<std::shared_ptr<Job>> running_;
+	std::vector<std::shared_ptr<Job>> finished_;
+	std::map<int, std::shared_ptr<Job>> jobs_;
+	int next_id_ = 1;
+	bool schedule_ = false;
+	bool stop_ = false;
+
+	static thread_local Job* current_;
+
+	// Last, everything above has to exist when it starts
+	std::thread thread_;
+};
+
+#endif
@@ -4,110 +4,101 @@
 
 #include <cmath>
 #include <iostream>
-#include <set>
 #include <algorithm>
 #include <climits>
 #include <chrono>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
-// For stopping in time
-auto g_stopping = chrono::system_clock::now();
-bool g_fast_calculation = false;
+// Compact candidate position
+using Coordinate = array<double, 3>;
 
-bool g_use_2d = false;
+static const double PI = atan(1) * 4;
 
-// Needed by Point
-static bool equal(double a, double b);
-
-class Point {
+// Candidate positions as separate coordinate arrays, so checks over many candidates vectorize
+class Candidates {
 public:
-	explicit Point(const string& ip) {
-		ip_ = ip;
-		set_ = false;
+	size_t size() const {
+		return x_.size();
 	}
 	
-	explicit Point(const array<double, 3>& coordinates) {
-		coordinates_ = coordinates;
-		ip_ = "";
-		set_ = true;
+	void resize(size_t size) {
+		x_.resize(size);
+		y_.resize(size);
+		z_.resize(size);
 	}
 	
-	void setPosition(const array<double, 3>& coordinates) {
-		coordinates_ = coordinates;
-		set_ = true;
+	void add(double x, double y, double z) {
+		x_.push_back(x);
+		y_.push_back(y);
+		z_.push_back(z);
 	}
 	
-	const array<double, 3>& getPosition() const {
-		return coordinates_;
+	Coordinate get(size_t i) const {
+		return {{ x_[i], y_[i], z_[i] }};
 	}
 	
-	const string& getIP() {
-		return ip_;
-	}
+	vector<double> x_;
+	vector<double> y_;
+	vector<double> z_;
+};
+
+// Stops a search once a solution is found or, in fast mode, when time is up
+class CancellationToken {
+public:
+	CancellationToken(chrono::steady_clock::time_point deadline, bool use_deadline) :
+		deadline_(deadline), use_deadline_(use_deadline) {}
 	
-	double getX() const {
-		return coordinates_.front();
+	void cancel() {
+		cancelled_ = true;
 	}
 	
-	double getY() const {
-		return coordinates_.at(1);
+	bool isCancelled() {
+		if (!cancelled_ && use_deadline_ && chrono::steady_clock::now() > deadline_)
+			cancelled_ = true;
+			
+		return cancelled_;
 	}
 	
-	double getZ() const {
-		return coordinates_.back();
-	}
+private:
+	atomic<bool> cancelled_{ false };
+	chrono::steady_clock::time_point deadline_;
+	bool use_deadline_;
+};
+
+// State shared read-only by every task of one placement search
+class Search {
+public:
+	Search(const vector<double>& distances, size_t size, CancellationToken& token) :
+		distances_(distances), size_(size), token_(token) {}
 	
-	void addDistance(double distance) {
-		distances_.push_back(distance);	
+	// Measured distance between two nodes, the matrix is row-major
+	double getDistance(size_t from, size_t to) const {
+		return distances_[from * size_ + to];
 	}
 	
-	double getDistance(size_t i) const {
-		return distances_.at(i);
-	}
+	const vector<double>& distances_;
+	size_t size_;
+	CancellationToken& token_;
 	
-	double distanceTo(const Point& point) {
-		double sum = 0;
-		
-		for (size_t i = 0; i < coordinates_.size(); i++)
-			sum += (coordinates_.at(i) - point.getPosition().at(i)) * (coordinates_.at(i) - point.getPosition().at(i));
-			
-		return sqrt(sum);	
-	}
+	// Unit vectors for the current degree_accuracy
+	Candidates directions_;
 	
-	bool operator==(const Point& other) {
-		for (size_t i = 0; i < coordinates_.size(); i++)
-			if (!equal(coordinates_.at(i), other.getPosition().at(i)))
-				return false;
-				
-		return true;		
-	}
+	int degree_accuracy_	= 0;
+	double point_accuracy_	= 0;
+	bool use_2d_			= false;
 	
-	bool operator<(const Point& other) const {
-		for (size_t i = 0; i < coordinates_.size(); i++)
-			if (!equal(coordinates_.at(i), other.getPosition().at(i)))
-				return abs(coordinates_.at(i)) < abs(other.getPosition().at(i));
-				
-		return false;		
-	}
+	// Squared z-diff a solution has to beat
+	double z_bound_			= INT_MAX;
 	
-	friend ostream& operator<<(ostream& out, const Point& point) {
-		cout << "(" << point.getX() << ", " << point.getY() << ", " << point.getZ() << ")";
-		
-		return out;
-	}
-	
-private:
-	vector<double> distances_;
-	array<double, 3> coordinates_ = {{ 0, 0, 0 }};
-	string ip_;
-	bool set_;
+	mutex result_mutex_;
+	vector<Coordinate> result_;
 };
 
-static double PI;
-static int g_degree_accuracy;
-static double g_point_accuracy;
-
 // 0.001 is enough precision for Localization3D
 static bool equal(double a, double b) {
 	return abs(a - b) < 0.001;
@@ -117,237 +108,372 @@ static double radians(double degrees) {
 	return (degrees * PI) / 180;
 }
 
-static bool sortZ(const Point& a, const Point& b) {
-	return abs(a.getZ()) < abs(b.getZ());
+static bool sortZ(const Coordinate& a, const Coordinate& b) {
+	return abs(a.back()) < abs(b.back());
 }
 
-static vector<Point> getSinglePossibles(const Point& point, double actual_distance) {
-	vector<Point> possibles;
+// Every direction a node can be in from another node, at the given angle resolution
+static Candidates getDirections(int degree_accuracy, bool use_2d) {
+	Candidates directions;
 	
-	if (g_use_2d) {
-		for (int gamma = 0; gamma < 360; gamma += g_degree_accuracy) {
-			double x = point.getX() + actual_distance * cos(radians(gamma));
-			double y = point.getY() + actual_distance * sin(radians(gamma));
-				
-			possibles.push_back(Point(array<double, 3>({{ x, y, 0.0 }})));
-		}
+	if (use_2d) {
+		for (int gamma = 0; gamma < 360; gamma += degree_accuracy)
+			directions.add(cos(radians(gamma)), sin(radians(gamma)), 0.0);
 	} else {
-		for (int gamma = 0; gamma < 360; gamma += g_degree_accuracy) {
-			for (int omega = 0; omega < 360; omega += g_degree_accuracy) {
-				double x = point.getX() + actual_distance * cos(radians(gamma)) * sin(radians(omega));
-				double y = point.getY() + actual_distance * sin(radians(gamma)) * sin(radians(omega));
-				double z = point.getZ() + actual_distance * cos(omega);
-				
-				possibles.push_back(Point(array<double, 3>{{ x, y, z }}));
-			}
-		}
+		for (int gamma = 0; gamma < 360; gamma += degree_accuracy)
+			for (int omega = 0; omega < 360; omega += degree_accuracy)
+				directions.add(cos(radians(gamma)) * sin(radians(omega)), sin(radians(gamma)) * sin(radians(omega)), cos(radians(omega)));
 	}
 	
-	return possibles;
+	return directions;
 }
 
-template<class T>
-static void removeDuplicates(vector<T>& data) {
-	set<T> singulars;
-	size_t size = data.size();
+// Packs the grid cell of a coordinate into one key, 21 bits per axis
+static uint64_t getCellKey(const Coordinate& coordinate, double resolution) {
+	uint64_t key = 0;
 	
-	for (size_t i = 0; i < size; i++)
-		singulars.insert(data[i]);
-		
-	data.assign(singulars.begin(), singulars.end());
+	for (auto& value : coordinate) {
+		auto cell = static_cast<int64_t>(floor(value / resolution));
+		key = (key << 21) | (static_cast<uint64_t>(cell) & 0x1FFFFF);
+	}
+	
+	return key;
 }
 
-static vector<Point> getPossibles(const vector<Point>& points, size_t i) {
-	vector<Point> possibles;
-	vector<Point> working;
+static double distanceBetween(const Coordinate& a, const Coordinate& b) {
+	double sum = 0;
 	
-	#pragma omp parallel
-	{
-		vector<Point> parallel_possibles;
+	for (size_t i = 0; i < a.size(); i++)
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
 		
-		#pragma omp for
-		for (size_t j = 0; j < points.size(); j++) {
-			const Point& master = points.at(j);
-			double distance = master.getDistance(i);
-			auto master_possibles = getSinglePossibles(master, distance);
-			
-			parallel_possibles.insert(parallel_possibles.end(), master_possibles.begin(), master_possibles.end());
-		}
+	return sqrt(sum);
+}
+
+// Candidates are checked in blocks so a block can stop as soon as nothing in it is left
+static const size_t CANDIDATE_BLOCK = 64;
+
+// Runs inside search tasks, so it is serial on purpose
+static Candidates getPossibles(const Search& search, const vector<Coordinate>& placed) {
+	const auto& directions = search.directions_;
+	size_t i = placed.size();
+	size_t num_directions = directions.size();
+	
+	// Candidates on the sphere around every placed point
+	Candidates working;
+	working.resize(placed.size() * num_directions);
+	
+	for (size_t j = 0; j < placed.size(); j++) {
+		double distance = search.getDistance(j, i);
+		const auto& point = placed.at(j);
+		size_t offset = j * num_directions;
 		
-		#pragma omp critical
-		{
-			possibles.insert(possibles.end(), parallel_possibles.begin(), parallel_possibles.end());
+		#pragma omp simd
+		for (size_t c = 0; c < num_directions; c++) {
+			working.x_[offset + c] = point[0] + distance * directions.x_[c];
+			working.y_[offset + c] = point[1] + distance * directions.y_[c];
+			working.z_[offset + c] = point[2] + distance * directions.z_[c];
 		}
 	}
 	
-	removeDuplicates(possibles);
+	// Only keep candidates which agree with every placed point
+	vector<unsigned char> good(working.size(), 1);
 	
-	#pragma omp parallel
-	{
-		vector<Point> parallel_working;
+	for (size_t start = 0; start < working.size(); start += CANDIDATE_BLOCK) {
+		size_t end = min(start + CANDIDATE_BLOCK, working.size());
 		
-		#pragma omp for
-		for (size_t j = 0; j < possibles.size(); j++) {
-			Point& point = possibles.at(j);
-			bool good = true;
+		for (size_t k = 0; k < placed.size(); k++) {
+			double distance = search.getDistance(k, i);
+			double accuracy = search.point_accuracy_;
+			double x = placed.at(k)[0];
+			double y = placed.at(k)[1];
+			double z = placed.at(k)[2];
+			int alive = 0;
 			
-			for (auto& origin : points) {
-				double distance = origin.getDistance(i);
-				double test_distance = point.distanceTo(origin);
+			#pragma omp simd reduction(+:alive)
+			for (size_t c = start; c < end; c++) {
+				double dx = working.x_[c] - x;
+				double dy = working.y_[c] - y;
+				double dz = working.z_[c] - z;
+				double test_distance = sqrt(dx * dx + dy * dy + dz * dz);
 				
-				if (abs(distance - test_distance) > g_point_accuracy) {
-					good = false;
-					
-					break;
-				}
+				good[c] &= abs(distance - test_distance) <= accuracy;
+				alive += good[c];
 			}
+			
+			if (alive == 0)
+				break;
+		}
+	}
+	
+	// Candidates sharing a cell are indistinguishable at the current accuracy, keep the one closest to z = 0
+	unordered_map<uint64_t, size_t> cells;
+	vector<size_t> singulars;
+	
+	for (size_t c = 0; c < working.size(); c++) {
+		if (!good[c])
+			continue;
+			
+		auto inserted = cells.insert({ getCellKey(working.get(c), search.point_accuracy_), singulars.size() });
+		
+		if (inserted.second)
+			singulars.push_back(c);
+		else if (abs(working.z_[c]) < abs(working.z_[singulars.at(inserted.first->second)]))
+			singulars.at(inserted.first->second) = c;
+	}
+	
+	sort(singulars.begin(), singulars.end(), [&working] (size_t a, size_t b) {
+		return abs(working.z_[a]) < abs(working.z_[b]);
+	});
+	
+	Candidates possibles;
+	possibles.resize(singulars.size());
+	
+	for (size_t c = 0; c < singulars.size(); c++) {
+		possibles.x_[c] = working.x_[singulars[c]];
+		possibles.y_[c] = working.y_[singulars[c]];
+		possibles.z_[c] = working.z_[singulars[c]];
+	}
+	
+	return possibles;
+}
 
-			if (good) {
-				parallel_working.push_back(point);
+// Depth-first branch-and-bound over candidate positions, spawning a task per branch
+static void searchPlacement(Search& search, const vector<Coordinate>& placed, double z_sum) {
+	size_t remaining = search.size_ - placed.size();
+	auto possibles = getPossibles(search, placed);
+	
+	for (size_t c = 0; c < possibles.size(); c++) {
+		if (search.token_.isCancelled())
+			return;
+		
+		// Candidates are sorted on |z|, so the rest can only be worse
+		double next_z_sum = z_sum + possibles.z_[c] * possibles.z_[c];
+		
+		if (next_z_sum >= search.z_bound_)
+			break;
+			
+		vector<Coordinate> next(placed);
+		next.push_back(possibles.get(c));
+		
+		if (remaining == 1) {
+			lock_guard<mutex> guard(search.result_mutex_);
+			
+			if (search.result_.empty()) {
+				search.result_ = next;
+				search.token_.cancel();
 			}
+			
+			return;
 		}
 		
-		#pragma omp critical
-		{
-			working.insert(working.end(), parallel_working.begin(), parallel_working.end());
-		}
+		// Branches close to the leaves are cheaper to run than to schedule
+		#pragma omp task firstprivate(next, next_z_sum) shared(search) if(remaining > 2)
+		searchPlacement(search, next, next_z_sum);
 	}
+}
+
+static vector<Coordinate> getPlacement(Search& search) {
+	// Need to have some kind of reference
+	vector<Coordinate> reference = {{{ 0, 0, 0 }}};
 	
-	sort(working.begin(), working.end(), sortZ);
+	if (search.size_ < 2)
+		return reference;
 	
-	return working;
+	#pragma omp parallel
+	#pragma omp single
+	searchPlacement(search, reference, 0);
+	
+	return search.result_;
 }
 
-static vector<Point> getPlacement(vector<Point> points, size_t start) {
-	if (start >= points.size())
-		return points;
-		
-	vector<Point> origins(points.begin(), points.begin() + start);
-	vector<Point> possibles = getPossibles(origins, start);
+// Root mean square of the distance errors against fixed anchors
+static double getResidual(const Coordinate& position, const vector<Coordinate>& anchors, const vector<double>& distances) {
+	double sum = 0;
 	
-	// Do we have any possibility?
-	if (possibles.empty())
-		return vector<Point>();
+	for (size_t i = 0; i < anchors.size(); i++) {
+		double error = distanceBetween(position, anchors.at(i)) - distances.at(i);
+		sum += error * error;
+	}
 	
-	// We do, let's see if this is the last point
-	if (points.size() == start + 1) {
-		points.at(start).setPosition(possibles.front().getPosition());
+	return sqrt(sum / anchors.size());
+}
+
+// Gaussian elimination with partial pivoting, solution is left in b
+static bool solveLinear(double a[3][3], double b[3], size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		size_t pivot = i;
 		
-		return points;
+		for (size_t j = i + 1; j < n; j++)
+			if (abs(a[j][i]) > abs(a[pivot][i]))
+				pivot = j;
+				
+		if (abs(a[pivot][i]) < 1e-12)
+			return false;
+			
+		swap(a[i], a[pivot]);
+		swap(b[i], b[pivot]);
+		
+		for (size_t j = i + 1; j < n; j++) {
+			double factor = a[j][i] / a[i][i];
+			
+			for (size_t k = i; k < n; k++)
+				a[j][k] -= factor * a[i][k];
+				
+			b[j] -= factor * b[i];
+		}
 	}
 	
-	// It's not the last point, let's try every possiblity
-	volatile bool flag = false;
-	vector<Point> final_result;
+	for (size_t i = n; i-- > 0;) {
+		for (size_t k = i + 1; k < n; k++)
+			b[i] -= a[i][k] * b[k];
+			
+		b[i] /= a[i][i];
+	}
 	
-	#pragma omp parallel for shared(flag)
-	for (size_t i = 0; i < possibles.size(); i++) {
-		if (flag || ((chrono::system_clock::now() - g_stopping).count() > 0 && g_fast_calculation))
-			continue;
+	return true;
+}
+
+// Gauss-Newton on the distance errors, starting from the best grid candidate
+static Coordinate refinePosition(Coordinate position, const vector<Coordinate>& anchors, const vector<double>& distances, size_t dimensions) {
+	for (int iteration = 0; iteration < 20; iteration++) {
+		double jtj[3][3] = {{ 0 }};
+		double jtr[3] = { 0 };
+		
+		for (size_t i = 0; i < anchors.size(); i++) {
+			double distance = distanceBetween(position, anchors.at(i));
+			
+			if (distance < 1e-9)
+				continue;
+				
+			double error = distance - distances.at(i);
+			double jacobian[3];
 			
-		auto& possible = possibles.at(i);
-		points.at(start).setPosition(possible.getPosition());
+			for (size_t a = 0; a < dimensions; a++)
+				jacobian[a] = (position[a] - anchors.at(i)[a]) / distance;
+				
+			for (size_t a = 0; a < dimensions; a++) {
+				jtr[a] -= jacobian[a] * error;
+				
+				for (size_t b = 0; b < dimensions; b++)
+					jtj[a][b] += jacobian[a] * jacobian[b];
+			}
+		}
 		
-		vector<Point> result = getPlacement(points, start + 1);
+		if (!solveLinear(jtj, jtr, dimensions))
+			break;
+			
+		double step = 0;
 		
-		if (!result.empty()) {
-			#pragma omp critical
-			{
-				final_result = result;
-				flag = true;
-			}
+		for (size_t a = 0; a < dimensions; a++) {
+			position[a] += jtr[a];
+			step += jtr[a] * jtr[a];
 		}
+		
+		if (step < 1e-12)
+			break;
 	}
 	
-	return final_result;
+	return position;
 }
 
-double diffZ(const vector<Point>& points) {
+double diffZ(const vector<Coordinate>& points) {
 	double sum = 0;
 	
 	for (auto& point : points)
-		sum += (point.getZ() * point.getZ());
+		sum += (point.back() * point.back());
 		
 	return sqrt(sum);
 }
 
 vector<vector<double>> Localization3D::run(const Localization3DInput& input, bool fast_calcuation) {
-	g_degree_accuracy = Base::config().get<int>("degree_accuracy");
-	g_point_accuracy = Base::config().get<double>("point_accuracy");
-	PI = atan(1) * 4;
+	int degree_accuracy = Base::config().get<int>("degree_accuracy");
+	double point_accuracy = Base::config().get<double>("point_accuracy");
+	bool use_2d = Base::config().get<bool>("use_2d");
 	
-	vector<Point> points;
+	// Distances are kept once in a dense row-major matrix
+	size_t size = input.size();
+	vector<double> distances(size * size, 0);
 	
-	//cout << "Debug: input size " << input.size() << endl;
-	
-	for (auto& peer : input) {
-		auto& ip = peer.first;
-		auto& distances = peer.second;
-		
-		Point point(ip);
+	for (size_t i = 0; i < size; i++) {
+		auto& peer_distances = input.at(i).second;
 		
-		for (auto& distance : distances) {
-			point.addDistance(distance);
-			
-			//cout << "Debug: added distance " << distance << endl;
-		}
-			
-		points.push_back(point);	
+		for (size_t j = 0; j < min(size, peer_distances.size()); j++)
+			distances[i * size + j] = peer_distances.at(j);
 	}
 	
-	// Need to have some kind of reference
-	points.front().setPosition({{ 0, 0, 0 }});
-	
 	double best_point = INT_MAX;
 	double best_z_diff = INT_MAX;
-	vector<Point> best_points;
+	vector<Coordinate> best_points;
 	bool has_solution = false;
 	
 	//cout << "Debug: running localization\n";
 	
-	g_stopping = chrono::system_clock::now() + chrono::seconds(Base::config().get<int>("timeout"));
-	g_fast_calculation = fast_calcuation;
-	
-	g_use_2d = Base::config().get<bool>("use_2d");
-	
+	auto stopping = chrono::steady_clock::now() + chrono::seconds(Base::config().get<int>("timeout"));
 	bool stop = false;
 	
-	while (g_degree_accuracy > 0) {
-		cout << "Debug: trying degree " << g_degree_accuracy << endl;
+	while (degree_accuracy > 0) {
+		cout << "Debug: trying degree " << degree_accuracy << endl;
 		
-		g_point_accuracy = Base::config().get<double>("point_accuracy");
+		point_accuracy = Base::config().get<double>("point_accuracy");
 
-		while (g_point_accuracy > 0) {
+		while (point_accuracy > 0) {
 			// Check time limit here
-			if ((chrono::system_clock::now() - g_stopping).count() > 0 && fast_calcuation) {
+			if (chrono::steady_clock::now() > stopping && fast_calcuation) {
 				cout << "Debug: " << "Execution timed out\n";
 				stop = true;
 				
 				break;
 			}
+			
+			// A coarser result than the best one would be ignored anyway
+			if (point_accuracy > best_point && !equal(point_accuracy, best_point)) {
+				point_accuracy -= 0.01;
+				
+				continue;
+			}
+			
+			CancellationToken token(stopping, fast_calcuation);
+			Search search(distances, size, token);
+			search.degree_accuracy_ = degree_accuracy;
+			search.point_accuracy_ = point_accuracy;
+			search.use_2d_ = use_2d;
+			search.directions_ = getDirections(degree_accuracy, use_2d);
+			
+			// At the same accuracy, only a smaller z_diff is an improvement
+			bool bounded = equal(point_accuracy, best_point);
+			
+			if (bounded)
+				search.z_bound_ = best_z_diff * best_z_diff;
 				
-			vector<Point> basic_points(points);
-			auto results = getPlacement(basic_points, 1);
+			auto results = getPlacement(search);
 			
-			if (results.empty())
+			if (results.empty()) {
+				// Bounded searches can fail just by not improving
+				if (bounded) {
+					point_accuracy -= 0.01;
+					
+					continue;
+				}
+				
 				break;
+			}
 			
 			// If the current best result has the same point accuracy better z_diff, ignore it
-			if (g_point_accuracy < best_point || (equal(g_point_accuracy, best_point) && diffZ(results) < best_z_diff)) {
+			if (point_accuracy < best_point || (equal(point_accuracy, best_point) && diffZ(results) < best_z_diff)) {
 				// New best result
-				best_point = g_point_accuracy;
+				best_point = point_accuracy;
 				best_z_diff = diffZ(results);
 				best_points = results;
 				has_solution = true;
 			}
 			
-			g_point_accuracy -= 0.01;
+			point_accuracy -= 0.01;
 		}
 		
 		if (stop && fast_calcuation)
 			break;
 		
-		g_degree_accuracy--;
+		degree_accuracy--;
 	}
 	
 	vector<vector<double>> final_result;
@@ -356,7 +482,7 @@ vector<vector<double>> Localization3D::run(const Localization3DInput& input, boo
 		cout << "Debug: Localization3D got solution with accuracy " << best_point << " m and z_diff " << best_z_diff << endl; 
 		
 		for (auto& point : best_points) {
-			vector<double> position(point.getPosition().begin(), point.getPosition().begin() + (Base::config().get<bool>("use_2d") ? 2 : 3));
+			vector<double> position(point.begin(), point.begin() + (use_2d ? 2 : 3));
 			final_result.push_back(position);
 		}
 		
@@ -364,11 +490,50 @@ vector<vector<double>> Localization3D::run(const Localization3DInput& input, boo
 	} else {
 		cout << "Debug: no solution available\n";
 		
-		for (auto& point : points) {
-			vector<double> position(point.getPosition().begin(), point.getPosition().begin() + (Base::config().get<bool>("use_2d") ? 2 : 3));
-			final_result.push_back(position);
-		}
+		final_result.resize(size, vector<double>(use_2d ? 2 : 3, 0));
 	}
 	
 	return final_result;
+}
+
+vector<double> Localization3D::place(const vector<vector<double>>& anchors, const vector<double>& distances, double& residual) {
+	int degree_accuracy = Base::config().get<int>("degree_accuracy");
+	bool use_2d = Base::config().get<bool>("use_2d");
+	size_t dimensions = use_2d ? 2 : 3;
+	
+	vector<Coordinate> fixed;
+	
+	for (auto& anchor : anchors) {
+		Coordinate coordinate = {{ 0, 0, 0 }};
+		copy(anchor.begin(), anchor.begin() + min(anchor.size(), coordinate.size()), coordinate.begin());
+		
+		fixed.push_back(coordinate);
+	}
+	
+	// Coarse candidates around every anchor, then refine the best one
+	auto directions = getDirections(degree_accuracy, use_2d);
+	Coordinate best = {{ 0, 0, 0 }};
+	residual = INT_MAX;
+	
+	for (size_t i = 0; i < fixed.size(); i++) {
+		for (size_t c = 0; c < directions.size(); c++) {
+			Coordinate possible = fixed.at(i);
+			
+			possible[0] += distances.at(i) * directions.x_[c];
+			possible[1] += distances.at(i) * directions.y_[c];
+			possible[2] += distances.at(i) * directions.z_[c];
+			
+			double candidate_residual = getResidual(possible, fixed, distances);
+			
+			if (candidate_residual < residual || (equal(candidate_residual, residual) && sortZ(possible, best))) {
+				residual = candidate_residual;
+				best = possible;
+			}
+		}
+	}
+	
+	best = refinePosition(best, fixed, distances, dimensions);
+	residual = getResidual(best, fixed, distances);
+	
+	return vector<double>(best.begin(), best.begin() + dimensions);
 }
\ No newline at end of file
@@ -11,6 +11,9 @@ using Localization3DInput = std::vector<std::pair<std::string, std::vector<doubl
 class Localization3D {
 public:
 	static std::vector<std::vector<double>> run(const Localization3DInput& input, bool fast_calcuation);
+	
+	// Places one node against fixed anchor positions, residual is the RMS distance error
+	static std::vector<double> place(const std::vector<std::vector<double>>& anchors, const std::vector<double>& distances, double& residual);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "Log.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+static const char* LEVEL_PREFIXES[] = { "Debug: ", "", "Warning: ", "ERROR: " };
+
+atomic<int> Log::level_(LOG_LEVEL_DEBUG);
+
+Log::Log() :
+	slots_(new Slot[CAPACITY]) {
+	for (size_t i = 0; i < CAPACITY; i++)
+		slots_[i].sequence_ = i;
+
+	// Started last, see the member order
+	thread_ = thread(&Log::run, this);
+}
+
+// Never destroyed, static destructors may still log, whatever is left is flushed at exit
+Log& Log::get() {
+	static Log* log = [] () {
+		auto* log = new Log();
+		atexit(Log::flush);
+
+		return log;
+	}();
+
+	return *log;
+}
+
+void Log::setLevel(int level) {
+	level_ = level;
+}
+
+void Log::setLevel(const string& level) {
+	if (level == "debug")
+		setLevel(LOG_LEVEL_DEBUG);
+	else if (level == "info")
+		setLevel(LOG_LEVEL_INFO);
+	else if (level == "warning")
+		setLevel(LOG_LEVEL_WARNING);
+	else if (level == "error")
+		setLevel(LOG_LEVEL_ERROR);
+	else
+		LOG_WARNING("unknown log level " << level);
+}
+
+bool Log::isEnabled(int level) {
+	return level >= level_.load(memory_order_relaxed);
+}
+
+void Log::write(int level, string message) {
+	auto& log = get();
+
+	if (!log.push(level, message))
+		log.dropped_++;
+}
+
+// Bounded MPMC queue by Dmitry Vyukov, the sequence of a slot tells whose turn it is
+bool Log::push(int level, string& message) {
+	size_t position = head_.load(memory_order_relaxed);
+	Slot* slot;
+
+	while (true) {
+		slot = &slots_[position & (CAPACITY - 1)];
+		size_t sequence = slot->sequence_.load(memory_order_acquire);
+		auto difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+
+		if (difference == 0) {
+			if (head_.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+				break;
+		} else if (difference < 0) {
+			// Full, the writer thread is a whole ring behind
+			return false;
+		} else {
+			position = head_.load(memory_order_relaxed);
+		}
+	}
+
+	slot->level_ = level;
+	slot->message_ = move(message);
+	slot->sequence_.store(position + 1, memory_order_release);
+
+	return true;
+}
+
+// Only called by the writer thread
+bool Log::pop(int& level, string& message) {
+	size_t position = tail_.load(memory_order_relaxed);
+	auto& slot = slots_[position & (CAPACITY - 1)];
+
+	if (slot.sequence_.load(memory_order_acquire) != position + 1)
+		return false;
+
+	level = slot.level_;
+	message = move(slot.message_);
+	slot.sequence_.store(position + CAPACITY, memory_order_release);
+	tail_.store(position + 1, memory_order_release);
+
+	return true;
+}
+
+void Log::run() {
+	int level;
+	string message;
+
+	while (true) {
+		bool written = false;
+
+		while (pop(level, message)) {
+			cout << LEVEL_PREFIXES[level] << message << '\n';
+			written = true;
+		}
+
+		auto dropped = dropped_.exchange(0);
+
+		if (dropped > 0) {
+			cout << "Warning: dropped " << dropped << " log messages\n";
+			written = true;
+		}
+
+		if (written)
+			cout.flush();
+		else
+			this_thread::sleep_for(chrono::milliseconds(2));
+	}
+}
+
+void Log::flush() {
+	auto& log = get();
+	size_t position = log.head_.load(memory_order_acquire);
+
+	while (log.tail_.load(memory_order_acquire) < position)
+		this_thread::sleep_for(chrono::milliseconds(1));
+}
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef LOG_H
+#define LOG_H
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+
+enum {
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_ERROR
+};
+
+/*
+	Leveled logging that doesn't block the caller. Messages go into a fixed size lock-free ring
+	and a background thread writes them to stdout, so logging from solver loops and OpenMP
+	threads costs a string and no lock. If the ring is full messages are dropped and counted.
+
+	Use the macros, LOG_DEBUG is compiled out unless built with DEBUG (make DEBUG=1) and its
+	arguments are not even evaluated.
+*/
+class Log {
+public:
+	static void setLevel(int level);
+	static void setLevel(const std::string& level);
+	static bool isEnabled(int level);
+	static void write(int level, std::string message);
+
+	// Waits until everything written so far is out
+	static void flush();
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence_;
+		int level_;
+		std::string message_;
+	};
+
+	Log();
+	static Log& get();
+
+	bool push(int level, std::string& message);
+	bool pop(int& level, std::string& message);
+	void run();
+
+	static const size_t CAPACITY = 1 << 14;
+
+	std::unique_ptr<Slot[]> slots_;
+	std::atomic<size_t> head_ { 0 };
+	std::atomic<size_t> tail_ { 0 };
+	std::atomic<size_t> dropped_ { 0 };
+
+	static std::atomic<int> level_;
+
+	// Last, everything above has to exist when it starts
+	std::thread thread_;
+};
+
+// Space separated, for logging EQs and band levels on one line
+template<class Container>
+std::string joinValues(const Container& values) {
+	std::ostringstream stream;
+
+	for (auto& value : values)
+		stream << value << " ";
+
+	return stream.str();
+}
+
+#define LOG_WRITE(level, message) do { \
+	if (Log::isEnabled(level)) { \
+		std::ostringstream log_stream; \
+		log_stream << message; \
+		Log::write(level, log_stream.str()); \
+	} \
+} while (false)
+
+#ifdef DEBUG
+#define LOG_DEBUG(message) LOG_WRITE(LOG_LEVEL_DEBUG, message)
+#else
+#define LOG_DEBUG(message) do { } while (false)
+#endif
+
+#define LOG_INFO(message) LOG_WRITE(LOG_LEVEL_INFO, message)
+#define LOG_WARNING(message) LOG_WRITE(LOG_LEVEL_WARNING, message)
+#define LOG_ERROR(message) LOG_WRITE(LOG_LEVEL_ERROR, message)
+
+#endif
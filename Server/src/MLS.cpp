@@ -0,0 +1,150 @@
+#include "MLS.h"
+
+#include <cmath>
+#include <climits>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+// Feedback taps of maximal length shift registers, indexed by order
+static const vector<vector<int>> g_taps = {
+	{}, {}, { 2, 1 }, { 3, 2 }, { 4, 3 }, { 5, 3 }, { 6, 5 }, { 7, 6 }, { 8, 6, 5, 4 }, { 9, 5 },
+	{ 10, 7 }, { 11, 9 }, { 12, 6, 4, 1 }, { 13, 4, 3, 1 }, { 14, 5, 3, 1 }, { 15, 14 }, { 16, 15, 13, 4 },
+	{ 17, 14 }, { 18, 11 }, { 19, 6, 2, 1 }, { 20, 17 }
+};
+
+// In place, x has to be a power of two long
+static void fastHadamard(vector<double>& x) {
+	for (size_t half = x.size() / 2; half > 0; half /= 2) {
+		for (size_t block = 0; block < x.size(); block += 2 * half) {
+			for (size_t i = block; i < block + half; i++) {
+				double sum = x[i] + x[i + half];
+				x[i + half] = x[i] - x[i + half];
+				x[i] = sum;
+			}
+		}
+	}
+}
+
+namespace nac {
+	MLS::MLS(int order) {
+		if (order < 2 || order >= static_cast<int>(g_taps.size())) {
+			cout << "Error: MLS order " << order << " is not supported\n";
+
+			throw exception();
+		}
+
+		order_ = order;
+
+		// Fibonacci shift register, s[n] is the xor of s[n - tap] for every tap
+		size_t length = (1 << order) - 1;
+		vector<bool> state(order, true);
+		sequence_.resize(length);
+
+		for (size_t i = 0; i < length; i++) {
+			bool feedback = false;
+
+			for (auto& tap : g_taps.at(order))
+				feedback ^= state.at(tap - 1);
+
+			sequence_[i] = state.back();
+			state.pop_back();
+			state.insert(state.begin(), feedback);
+		}
+
+		generateTags();
+	}
+
+	size_t MLS::size() const {
+		return sequence_.size();
+	}
+
+	/*
+		Tags from J. Hee, "Impulse response measurements using MLS". tag_s_ reads the first
+		order_ samples of every column of the circulant matrix as a binary number, tag_l_ does
+		the same for the rows through the columns holding the powers of two.
+	*/
+	void MLS::generateTags() {
+		size_t length = sequence_.size();
+		vector<size_t> index(order_, 0);
+
+		tag_s_.assign(length, 0);
+		tag_l_.assign(length, 0);
+
+		for (size_t i = 0; i < length; i++) {
+			for (int j = 0; j < order_; j++)
+				tag_s_[i] += static_cast<size_t>(sequence_[(length + i - j) % length]) << (order_ - 1 - j);
+
+			for (int j = 0; j < order_; j++)
+				if (tag_s_[i] == (static_cast<size_t>(1) << j))
+					index[j] = i;
+		}
+
+		for (size_t i = 0; i < length; i++)
+			for (int j = 0; j < order_; j++)
+				tag_l_[i] += static_cast<size_t>(sequence_[(length + index[j] - i) % length]) << j;
+	}
+
+	// The first period only lets the room reach steady state, it is never analysed
+	vector<short> MLS::createSignal(size_t periods, double level) const {
+		double amplitude = pow(10, level / 20) * SHRT_MAX;
+		vector<short> signal;
+		signal.reserve(sequence_.size() * (periods + 1));
+
+		for (size_t period = 0; period < periods + 1; period++)
+			for (bool bit : sequence_)
+				signal.push_back(lround(bit ? -amplitude : amplitude));
+
+		return signal;
+	}
+
+	/*
+		Averages periods of the capture from start and cross-correlates the average with the
+		sequence. The response is circular, so it is rotated to put the direct sound pre_delay
+		samples in.
+	*/
+	vector<double> MLS::getImpulseResponse(const vector<short>& capture, size_t start, size_t periods, double level, size_t pre_delay) const {
+		size_t length = sequence_.size();
+		vector<double> average(length, 0);
+
+		if (start + periods * length > capture.size()) {
+			cout << "Warning: capture is too short for " << periods << " MLS periods\n";
+
+			periods = start < capture.size() ? (capture.size() - start) / length : 0;
+		}
+
+		if (periods == 0)
+			return average;
+
+		// Scale so a capture of the signal itself gives a unit impulse
+		double scale = 1.0 / (pow(10, level / 20) * SHRT_MAX * periods * (length + 1));
+
+		for (size_t period = 0; period < periods; period++)
+			for (size_t i = 0; i < length; i++)
+				average[i] += capture[start + period * length + i];
+
+		vector<double> permuted(length + 1, 0);
+
+		for (size_t i = 0; i < length; i++) {
+			permuted[0] -= average[i];
+			permuted[tag_s_[i]] = average[i];
+		}
+
+		fastHadamard(permuted);
+
+		vector<double> impulse_response(length);
+		size_t peak = 0;
+
+		for (size_t i = 0; i < length; i++) {
+			impulse_response[i] = permuted[tag_l_[i]] * scale;
+
+			if (abs(impulse_response[i]) > abs(impulse_response[peak]))
+				peak = i;
+		}
+
+		rotate(impulse_response.begin(), impulse_response.begin() + (peak + length - pre_delay % length) % length, impulse_response.end());
+
+		return impulse_response;
+	}
+}
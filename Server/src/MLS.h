@@ -0,0 +1,30 @@
+#pragma once
+#ifndef NAC_MLS_H
+#define NAC_MLS_H
+
+#include <vector>
+#include <cstddef>
+
+// Maximum length sequence measurements, deconvolved with a fast Hadamard transform
+namespace nac {
+	class MLS {
+	public:
+		explicit MLS(int order);
+
+		size_t size() const;
+		std::vector<short> createSignal(size_t periods, double level) const;
+		std::vector<double> getImpulseResponse(const std::vector<short>& capture, size_t start, size_t periods, double level, size_t pre_delay) const;
+
+	private:
+		void generateTags();
+
+		int order_;
+		std::vector<bool> sequence_;
+
+		// Permutations turning the circular cross-correlation into a Hadamard transform
+		std::vector<size_t> tag_s_;
+		std::vector<size_t> tag_l_;
+	};
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "Multitone.h"
+#include "Sweep.h"
+
+#include <cmath>
+#include <climits>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+namespace nac {
+	/*
+		Bins between the lowest and highest band limit are dealt out to the speakers in turn,
+		so every comb covers every band as long as each band is at least one bin per speaker wide.
+	*/
+	Multitone::Multitone(int order, size_t speakers, const vector<double>& bands, double octave_width, double level, int fs) {
+		if (order < 10 || order > 22 || speakers == 0 || bands.empty()) {
+			cout << "Error: multitone order " << order << " with " << speakers << " speakers is not supported\n";
+
+			throw exception();
+		}
+
+		size_ = static_cast<size_t>(1) << order;
+		fs_ = fs;
+
+		double resolution = static_cast<double>(fs_) / size_;
+		double width = pow(2.0, 1.0 / (2.0 * octave_width));
+
+		size_t first = max<size_t>(lround(ceil(bands.front() / width / resolution)), 1);
+		size_t last = min<size_t>(lround(floor(bands.back() * width / resolution)), size_ / 2 - 1);
+
+		bins_.resize(speakers);
+		tones_.resize(speakers);
+
+		for (size_t bin = first; bin <= last; bin++)
+			bins_.at((bin - first) % speakers).push_back(bin);
+
+		for (size_t i = 0; i < speakers; i++) {
+			auto& bins = bins_.at(i);
+			size_t tones = bins.size();
+
+			// Pink amplitudes keep the energy per band constant, Schroeder phases keep the crest factor low
+			for (size_t m = 0; m < tones; m++) {
+				double amplitude = 1 / sqrt(bins.at(m) * resolution);
+				double phase = -PI * m * (m + 1) / tones;
+
+				tones_.at(i).push_back(polar(amplitude, phase));
+			}
+
+			vector<complex<double>> spectrum(size_ / 2 + 1, 0);
+
+			for (size_t m = 0; m < tones; m++)
+				spectrum.at(bins.at(m)) = tones_.at(i).at(m);
+
+			periods_.push_back(inverseFFT(spectrum, size_));
+
+			double peak = 0;
+
+			for (auto& sample : periods_.back())
+				peak = max(peak, abs(sample));
+
+			scales_.push_back(peak > 0 ? pow(10, level / 20) / peak : 1);
+		}
+
+		for (auto& centre : bands) {
+			double lower = centre / width / resolution;
+			double upper = centre * width / resolution;
+			long band_bins = lround(floor(upper)) - lround(ceil(lower)) + 1;
+
+			if (band_bins < static_cast<long>(speakers)) {
+				cout << "Warning: the " << centre << " Hz band only fits " << max(band_bins, 0L) << " tones for " << speakers << " speakers, increase multitone_order\n";
+
+				break;
+			}
+		}
+	}
+
+	size_t Multitone::size() const {
+		return size_;
+	}
+
+	// The first period only lets the room reach steady state, it is never analysed
+	vector<short> Multitone::createSignal(size_t speaker, size_t periods) const {
+		auto& period = periods_.at(speaker);
+
+		vector<short> signal;
+		signal.reserve(size_ * (periods + 1));
+
+		for (size_t i = 0; i < periods + 1; i++)
+			for (auto& sample : period)
+				signal.push_back(lround(sample * scales_.at(speaker) * SHRT_MAX));
+
+		return signal;
+	}
+
+	// Averaging whole periods keeps every tone in its own bin, the start doesn't have to be synchronized
+	vector<complex<double>> Multitone::getSpectrum(const vector<short>& capture, size_t start, size_t periods) const {
+		if (start + periods * size_ > capture.size()) {
+			cout << "Warning: capture is too short for " << periods << " multitone periods\n";
+
+			periods = start < capture.size() ? (capture.size() - start) / size_ : 0;
+		}
+
+		vector<double> average(size_, 0);
+
+		if (periods == 0)
+			return vector<complex<double>>(size_ / 2 + 1, 0);
+
+		for (size_t period = 0; period < periods; period++)
+			for (size_t i = 0; i < size_; i++)
+				average[i] += capture[start + period * size_ + i];
+
+		for (auto& sample : average)
+			sample /= periods * (double)SHRT_MAX;
+
+		return forwardFFT(average, size_);
+	}
+
+	/*
+		Transfer function power at the tones of one speaker, interpolated to the bins of doFFT()
+		and divided by frequency to follow its pink noise convention.
+	*/
+	FFTOutput Multitone::getResponse(const vector<complex<double>>& spectrum, size_t speaker) const {
+		auto& bins = bins_.at(speaker);
+		auto& tones = tones_.at(speaker);
+
+		vector<double> tone_frequencies;
+		vector<double> tone_energy;
+
+		for (size_t m = 0; m < bins.size(); m++) {
+			auto played = tones.at(m) * scales_.at(speaker);
+
+			tone_frequencies.push_back((double)bins.at(m) * fs_ / size_);
+			tone_energy.push_back(norm(spectrum.at(bins.at(m)) / played));
+		}
+
+		vector<double> frequencies(RESPONSE_FFT_SIZE / 2);
+		vector<double> energy(RESPONSE_FFT_SIZE / 2, 0);
+
+		if (tone_frequencies.empty())
+			return { frequencies, energy };
+
+		for (size_t i = 0; i < frequencies.size(); i++) {
+			frequencies[i] = (double)i * fs_ / RESPONSE_FFT_SIZE;
+
+			if (i == 0)
+				continue;
+
+			auto upper = lower_bound(tone_frequencies.begin(), tone_frequencies.end(), frequencies[i]);
+			double value;
+
+			if (upper == tone_frequencies.begin()) {
+				value = tone_energy.front();
+			} else if (upper == tone_frequencies.end()) {
+				value = tone_energy.back();
+			} else {
+				size_t m = distance(tone_frequencies.begin(), upper);
+				double t = (frequencies[i] - tone_frequencies[m - 1]) / (tone_frequencies[m] - tone_frequencies[m - 1]);
+
+				value = tone_energy[m - 1] + t * (tone_energy[m] - tone_energy[m - 1]);
+			}
+
+			energy[i] = value / frequencies[i];
+		}
+
+		return { frequencies, energy };
+	}
+
+	// The level this speaker's tones are recorded at, in dB relative to full scale
+	double Multitone::getLevel(const vector<complex<double>>& spectrum, size_t speaker) const {
+		double energy = 0;
+
+		for (auto& bin : bins_.at(speaker))
+			energy += 2 * norm(spectrum.at(bin));
+
+		return 10 * log10(energy / ((double)size_ * size_));
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef NAC_MULTITONE_H
+#define NAC_MULTITONE_H
+
+#include "Analyze.h"
+
+#include <vector>
+#include <complex>
+#include <cstddef>
+
+/*
+	Interleaved multitone measurements. Every speaker gets its own comb of FFT bins, so all
+	speakers can play at once and still be told apart in one FFT of the capture.
+*/
+namespace nac {
+	class Multitone {
+	public:
+		// Every speaker's signal peaks at level dBFS
+		Multitone(int order, size_t speakers, const std::vector<double>& bands, double octave_width, double level, int fs = 48000);
+
+		size_t size() const;
+		std::vector<short> createSignal(size_t speaker, size_t periods) const;
+
+		std::vector<std::complex<double>> getSpectrum(const std::vector<short>& capture, size_t start, size_t periods) const;
+		FFTOutput getResponse(const std::vector<std::complex<double>>& spectrum, size_t speaker) const;
+		double getLevel(const std::vector<std::complex<double>>& spectrum, size_t speaker) const;
+
+	private:
+		size_t size_;
+		int fs_;
+
+		// Bins and unscaled tones per speaker
+		std::vector<std::vector<size_t>> bins_;
+		std::vector<std::vector<std::complex<double>>> tones_;
+
+		// Unscaled period per speaker and the scale that peaks it at the level
+		std::vector<std::vector<double>> periods_;
+		std::vector<double> scales_;
+	};
+}
+
+#endif
@@ -7,6 +7,26 @@
 
 class PartialPacket;
 
+// Keep in sync with the client
+enum {
+	PACKET_JOIN_SESSION,
+	PACKET_START_LOCALIZATION,
+	PACKET_CHECK_SPEAKERS_ONLINE,
+	PACKET_CHECK_SOUND_IMAGE,
+	PACKET_CHECK_SOUND_IMAGE_WHITE,
+	PACKET_SET_BEST_EQ,
+	PACKET_SET_EQ_STATUS,
+	PACKET_RESET_EVERYTHING,
+	PACKET_SET_SOUND_EFFECTS,
+	PACKET_TESTING,
+	PACKET_JOB_STARTED,
+	PACKET_JOB_PROGRESS,
+	PACKET_JOB_STATUS,
+	PACKET_JOB_CANCEL,
+	PACKET_SET_SETTING,
+	PACKET_VERIFY_SOUND_IMAGE
+};
+
 class Packet {
 public:
     Packet();
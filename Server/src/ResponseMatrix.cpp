@@ -0,0 +1,101 @@
+#include "ResponseMatrix.h"
+
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+using namespace std;
+
+ResponseMatrix::ResponseMatrix(size_t mics, size_t speakers, size_t bands) :
+	mics_(mics),
+	speakers_(speakers),
+	bands_(bands),
+	energy_(mics * speakers * bands, 0),
+	wanted_eq_(mics * speakers * bands, 0),
+	levels_(mics * speakers, 0) {
+}
+
+size_t ResponseMatrix::getIndex(size_t mic, size_t speaker) const {
+	return (mic * speakers_ + speaker) * bands_;
+}
+
+// Different slots can be set from different threads
+void ResponseMatrix::setResponse(size_t mic, size_t speaker, const vector<double>& dbs, double db_type) {
+	auto* energy = &energy_[getIndex(mic, speaker)];
+
+	for (size_t i = 0; i < min(dbs.size(), bands_); i++)
+		energy[i] = pow(10, dbs[i] / db_type);
+}
+
+void ResponseMatrix::setWantedEQ(size_t mic, size_t speaker, const vector<double>& eq) {
+	copy_n(eq.begin(), min(eq.size(), bands_), wanted_eq_.begin() + getIndex(mic, speaker));
+}
+
+void ResponseMatrix::setLevel(size_t mic, size_t speaker, double level) {
+	levels_[mic * speakers_ + speaker] = (double)SHRT_MAX * pow(10, level / 20);
+}
+
+vector<vector<double>> ResponseMatrix::weightEQs() const {
+	size_t size = speakers_ * bands_;
+	vector<double> total(size, 0);
+	vector<double> weighted(size, 0);
+
+	// Sk[i] = sum Ej[i] * Mj[i] / sum Ej[i], one pass per microphone over every speaker and band
+	for (size_t mic = 0; mic < mics_; mic++) {
+		const double* energy = &energy_[getIndex(mic, 0)];
+		const double* wanted_eq = &wanted_eq_[getIndex(mic, 0)];
+
+		#pragma omp simd
+		for (size_t i = 0; i < size; i++) {
+			total[i] += energy[i];
+			weighted[i] += energy[i] * wanted_eq[i];
+		}
+	}
+
+	vector<vector<double>> final_eqs(speakers_, vector<double>(bands_, 0));
+
+	for (size_t speaker = 0; speaker < speakers_; speaker++) {
+		for (size_t band = 0; band < bands_; band++) {
+			size_t i = speaker * bands_ + band;
+
+			// No microphone heard it, leave it flat
+			if (total[i] > 0)
+				final_eqs[speaker][band] = weighted[i] / total[i];
+		}
+	}
+
+	return final_eqs;
+}
+
+vector<double> ResponseMatrix::weightGain(const vector<double>& changes) const {
+	vector<double> total(speakers_, 0);
+	vector<double> final_change(speakers_, 0);
+
+	for (size_t mic = 0; mic < mics_; mic++) {
+		const double* levels = &levels_[mic * speakers_];
+
+		#pragma omp simd
+		for (size_t speaker = 0; speaker < speakers_; speaker++) {
+			total[speaker] += levels[speaker];
+			final_change[speaker] += levels[speaker] * changes[mic];
+		}
+	}
+
+	for (size_t speaker = 0; speaker < speakers_; speaker++)
+		if (total[speaker] > 0)
+			final_change[speaker] /= total[speaker];
+
+	return final_change;
+}
+
+size_t ResponseMatrix::getNumMics() const {
+	return mics_;
+}
+
+size_t ResponseMatrix::getNumSpeakers() const {
+	return speakers_;
+}
+
+size_t ResponseMatrix::getNumBands() const {
+	return bands_;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef RESPONSE_MATRIX_H
+#define RESPONSE_MATRIX_H
+
+#include <vector>
+#include <cstddef>
+
+/*
+	Results of one calibration run, every microphone against every speaker. Microphones and
+	speakers are indexed by their position in the IP lists of the run and everything is kept
+	as flat [mic][speaker][band] arrays, already linear, so weighting is a few passes over
+	contiguous memory instead of IP lookups.
+*/
+class ResponseMatrix {
+public:
+	ResponseMatrix(size_t mics, size_t speakers, size_t bands);
+
+	// db_type is 10 for power and 20 for voltage, see Speaker::getdBType()
+	void setResponse(size_t mic, size_t speaker, const std::vector<double>& dbs, double db_type);
+	void setWantedEQ(size_t mic, size_t speaker, const std::vector<double>& eq);
+	void setLevel(size_t mic, size_t speaker, double level);
+
+	// Per speaker, the EQs wanted by the microphones weighted by how much of its energy they get
+	std::vector<std::vector<double>> weightEQs() const;
+
+	// Per speaker, the gain changes wanted by the microphones weighted by sound level
+	std::vector<double> weightGain(const std::vector<double>& changes) const;
+
+	size_t getNumMics() const;
+	size_t getNumSpeakers() const;
+	size_t getNumBands() const;
+
+private:
+	size_t getIndex(size_t mic, size_t speaker) const;
+
+	size_t mics_;
+	size_t speakers_;
+	size_t bands_;
+
+	std::vector<double> energy_;
+	std::vector<double> wanted_eq_;
+
+	// [mic][speaker]
+	std::vector<double> levels_;
+};
+
+#endif
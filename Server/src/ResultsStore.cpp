@@ -0,0 +1,268 @@
+#include "ResultsStore.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const uint32_t RECORD_MAGIC = 0x5243414e; // "NACR"
+
+struct RecordHeader {
+	uint32_t magic_;
+	uint32_t type_;
+	uint32_t key_size_;
+	uint32_t reserved_;
+	uint64_t payload_size_;
+};
+
+static const string RUN_PREFIX = "run/";
+
+// FNV-1a
+static uint64_t getHash(const string& key) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (unsigned char c : key) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t getFileSize(const string& file) {
+	struct stat status;
+
+	return stat(file.c_str(), &status) == 0 ? status.st_size : 0;
+}
+
+bool ResultsStore::open(const string& path) {
+	lock_guard<mutex> guard(mutex_);
+
+	string data_file = path + ".dat";
+	string index_file = path + ".idx";
+
+	// A crash can leave half an entry at the end of the index, appending after it would shift the rest
+	auto index_size = getFileSize(index_file);
+
+	if (index_size % sizeof(Entry) != 0 && truncate(index_file.c_str(), index_size - index_size % sizeof(Entry)) != 0) {
+		cout << "Warning: could not repair " << index_file << ": " << strerror(errno) << endl;
+
+		return false;
+	}
+
+	data_.open(data_file, ios::in | ios::out | ios::binary | ios::app);
+	index_.open(index_file, ios::in | ios::out | ios::binary | ios::app);
+
+	if (!data_.is_open() || !index_.is_open()) {
+		cout << "Warning: could not open results store " << path << endl;
+
+		data_.close();
+		index_.close();
+
+		return false;
+	}
+
+	auto data_size = getFileSize(data_file);
+	uint64_t indexed_end = 0;
+	Entry entry;
+
+	index_.seekg(0);
+
+	while (index_.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+		string key;
+
+		// Index written but the data never made it
+		if (!readKey(entry, key)) {
+			cout << "Warning: skipping broken results entry at " << entry.offset_ << endl;
+
+			continue;
+		}
+
+		entries_[entry.hash_] = entry;
+		indexed_end = max(indexed_end, entry.offset_ + sizeof(RecordHeader) + key.size() + entry.size_);
+
+		if (entry.type_ == RESULT_RUN && find(runs_.begin(), runs_.end(), key.substr(RUN_PREFIX.size())) == runs_.end())
+			runs_.push_back(key.substr(RUN_PREFIX.size()));
+	}
+
+	index_.clear();
+
+	if (indexed_end < data_size)
+		recover(indexed_end, data_size);
+
+	cout << "Opened results store " << path << " with " << entries_.size() << " entries from " << runs_.size() << " runs\n";
+
+	return true;
+}
+
+bool ResultsStore::isOpen() const {
+	return data_.is_open();
+}
+
+// Records after the last indexed one were written without their index entry
+void ResultsStore::recover(uint64_t indexed_end, uint64_t data_end) {
+	size_t recovered = 0;
+
+	for (uint64_t offset = indexed_end; offset + sizeof(RecordHeader) <= data_end; ) {
+		RecordHeader header;
+
+		data_.clear();
+		data_.seekg(offset);
+
+		if (!data_.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic_ != RECORD_MAGIC)
+			break;
+
+		uint64_t end = offset + sizeof(header) + header.key_size_ + header.payload_size_;
+
+		if (end > data_end)
+			break;
+
+		string key(header.key_size_, 0);
+		data_.read(&key[0], key.size());
+
+		Entry entry = { getHash(key), offset, header.payload_size_, header.type_, 0 };
+
+		index_.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		entries_[entry.hash_] = entry;
+
+		if (entry.type_ == RESULT_RUN)
+			runs_.push_back(key.substr(RUN_PREFIX.size()));
+
+		offset = end;
+		recovered++;
+	}
+
+	index_.flush();
+	data_.clear();
+
+	cout << "Recovered " << recovered << " unindexed results records\n";
+}
+
+bool ResultsStore::readKey(const Entry& entry, string& key) const {
+	RecordHeader header;
+
+	data_.clear();
+	data_.seekg(entry.offset_);
+
+	if (!data_.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic_ != RECORD_MAGIC)
+		return false;
+
+	key.assign(header.key_size_, 0);
+
+	return static_cast<bool>(data_.read(&key[0], key.size()));
+}
+
+bool ResultsStore::append(const string& key, uint32_t type, const char* payload, uint64_t size) {
+	lock_guard<mutex> guard(mutex_);
+
+	if (!data_.is_open())
+		return false;
+
+	data_.clear();
+	data_.seekp(0, ios::end);
+
+	RecordHeader header = { RECORD_MAGIC, type, static_cast<uint32_t>(key.size()), 0, size };
+	Entry entry = { getHash(key), static_cast<uint64_t>(data_.tellp()), size, type, 0 };
+
+	// Data before index, so an index entry never points at missing data
+	data_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	data_.write(key.data(), key.size());
+	data_.write(payload, size);
+	data_.flush();
+
+	if (!data_) {
+		cout << "Warning: could not write results record " << key << endl;
+
+		return false;
+	}
+
+	index_.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	index_.flush();
+
+	entries_[entry.hash_] = entry;
+
+	if (type == RESULT_RUN && find(runs_.begin(), runs_.end(), key.substr(RUN_PREFIX.size())) == runs_.end())
+		runs_.push_back(key.substr(RUN_PREFIX.size()));
+
+	return true;
+}
+
+bool ResultsStore::read(const string& key, uint32_t type, string& payload) const {
+	lock_guard<mutex> guard(mutex_);
+
+	auto iterator = entries_.find(getHash(key));
+
+	if (iterator == entries_.end() || iterator->second.type_ != type)
+		return false;
+
+	auto& entry = iterator->second;
+	string stored_key;
+
+	// Different keys with the same hash
+	if (!readKey(entry, stored_key) || stored_key != key) {
+		cout << "Warning: results key " << key << " collides with " << stored_key << endl;
+
+		return false;
+	}
+
+	payload.assign(entry.size_, 0);
+
+	return static_cast<bool>(data_.read(&payload[0], payload.size()));
+}
+
+bool ResultsStore::addRun(const string& run, const vector<double>& metadata) {
+	return append(RUN_PREFIX + run, RESULT_RUN, reinterpret_cast<const char*>(metadata.data()), metadata.size() * sizeof(double));
+}
+
+vector<string> ResultsStore::getRuns() const {
+	lock_guard<mutex> guard(mutex_);
+
+	return runs_;
+}
+
+bool ResultsStore::add(const string& key, const vector<short>& samples) {
+	return append(key, RESULT_PCM, reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(short));
+}
+
+bool ResultsStore::add(const string& key, const vector<double>& values) {
+	return append(key, RESULT_VALUES, reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+}
+
+bool ResultsStore::get(const string& key, vector<short>& samples) const {
+	string payload;
+
+	if (!read(key, RESULT_PCM, payload))
+		return false;
+
+	samples.resize(payload.size() / sizeof(short));
+	memcpy(samples.data(), payload.data(), samples.size() * sizeof(short));
+
+	return true;
+}
+
+bool ResultsStore::get(const string& key, vector<double>& values) const {
+	string payload;
+
+	if (!read(key, RESULT_VALUES, payload))
+		return false;
+
+	values.resize(payload.size() / sizeof(double));
+	memcpy(values.data(), payload.data(), values.size() * sizeof(double));
+
+	return true;
+}
+
+bool ResultsStore::contains(const string& key) const {
+	lock_guard<mutex> guard(mutex_);
+
+	return entries_.count(getHash(key)) > 0;
+}
+
+// Empty parts are kept so keys stay unambiguous, e.g. captures have no speaker
+string ResultsStore::getKey(const string& run, const string& room, const string& speaker, const string& mic, const string& field) {
+	return run + "/" + room + "/" + speaker + "/" + mic + "/" + field;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef RESULTS_STORE_H
+#define RESULTS_STORE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+enum {
+	RESULT_RUN,
+	RESULT_PCM,
+	RESULT_VALUES
+};
+
+/*
+	Append-only store for calibration results. Records go to <path>.dat and a fixed size entry
+	per record to <path>.idx, which is read into a hash map on open. A key is written again to
+	update it, the latest record wins.
+*/
+class ResultsStore {
+public:
+	bool open(const std::string& path);
+	bool isOpen() const;
+
+	// Every run gets a record of its own so runs can be listed without scanning the data
+	bool addRun(const std::string& run, const std::vector<double>& metadata);
+	std::vector<std::string> getRuns() const;
+
+	bool add(const std::string& key, const std::vector<short>& samples);
+	bool add(const std::string& key, const std::vector<double>& values);
+
+	bool get(const std::string& key, std::vector<short>& samples) const;
+	bool get(const std::string& key, std::vector<double>& values) const;
+	bool contains(const std::string& key) const;
+
+	static std::string getKey(const std::string& run, const std::string& room, const std::string& speaker, const std::string& mic, const std::string& field);
+
+private:
+	struct Entry {
+		uint64_t hash_;
+		uint64_t offset_;
+		uint64_t size_;
+		uint32_t type_;
+		uint32_t reserved_;
+	};
+
+	bool append(const std::string& key, uint32_t type, const char* payload, uint64_t size);
+	bool read(const std::string& key, uint32_t type, std::string& payload) const;
+	bool readKey(const Entry& entry, std::string& key) const;
+	void recover(uint64_t indexed_end, uint64_t data_end);
+
+	std::unordered_map<uint64_t, Entry> entries_;
+	std::vector<std::string> runs_;
+
+	mutable std::mutex mutex_;
+	mutable std::fstream data_;
+	std::fstream index_;
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "SSHPool.h"
+#include "Base.h"
+#include "Config.h"
+#include "Log.h"
+
+// libcurlpp
+#include <curlpp/cURLpp.hpp>
+#include <curlpp/Options.hpp>
+#include <curlpp/Easy.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <functional>
+
+using namespace std;
+
+static void enableSSH(const string& ip) {
+	cURLpp::Cleanup clean;
+	string disable_string = "http://";
+	disable_string += ip;
+	disable_string += "/axis-cgi/admin/param.cgi?action=update&Network.SSH.Enabled=yes";
+
+	cURLpp::Easy request;
+	ostringstream stream;
+
+	request.setOpt(cURLpp::options::Url(disable_string.c_str()));
+	request.setOpt(cURLpp::options::UserPwd(string("root:pass")));
+	request.setOpt(cURLpp::options::HttpAuth(CURLAUTH_ANY));
+	request.setOpt(cURLpp::options::WriteStream(&stream));
+	request.setOpt(cURLpp::options::Timeout(10));
+
+	try {
+		request.perform();
+	} catch (cURLpp::RuntimeError& exception) {
+		// GET request failed
+		LOG_WARNING("request timed out in trying to set SSH enable\nRequest: " << disable_string << "\ncURLpp error: " << exception.what());
+
+		return;
+	}
+
+	if (stream.str() != "OK")
+		LOG_ERROR("enableSSH() failed for " << ip);
+}
+
+// Runs work(i) for every i < count on a thread each
+static void forEach(size_t count, const function<void(size_t)>& work) {
+	vector<thread> threads;
+
+	for (size_t i = 0; i < count; i++)
+		threads.emplace_back(work, i);
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// The same speaker can be in a request more than once, e.g. playing and recording
+static vector<pair<string, vector<size_t>>> groupByIP(const vector<string>& ips) {
+	vector<pair<string, vector<size_t>>> groups;
+
+	for (size_t i = 0; i < ips.size(); i++) {
+		auto iterator = find_if(groups.begin(), groups.end(), [&ips, i] (const pair<string, vector<size_t>>& group) {
+			return group.first == ips.at(i);
+		});
+
+		if (iterator == groups.end())
+			groups.push_back({ ips.at(i), { i } });
+		else
+			iterator->second.push_back(i);
+	}
+
+	return groups;
+}
+
+static vector<string> select(const vector<string>& values, const vector<size_t>& indices) {
+	vector<string> selected;
+
+	for (auto index : indices)
+		selected.push_back(values.at(index));
+
+	return selected;
+}
+
+SSHPool::SSHPool() :
+	epochs_(0) {
+}
+
+SSHPool::~SSHPool() {
+	{
+		lock_guard<mutex> guard(mutex_);
+		stop_ = true;
+	}
+
+	condition_.notify_all();
+
+	if (thread_.joinable())
+		thread_.join();
+}
+
+SSHPool::Connections SSHPool::getConnections(const vector<string>& ips) {
+	Connections connections;
+
+	{
+		lock_guard<mutex> guard(mutex_);
+
+		if (!thread_.joinable())
+			thread_ = thread(&SSHPool::run, this);
+
+		for (auto& ip : ips) {
+			auto& connection = connections_[ip];
+
+			if (!connection) {
+				connection = make_shared<Connection>();
+				connection->ip_ = ip;
+				connection->online_ = false;
+				connection->epoch_ = 0;
+			}
+
+			connections.push_back(connection);
+		}
+	}
+
+	Connections offline;
+	copy_if(connections.begin(), connections.end(), back_inserter(offline), [] (const shared_ptr<Connection>& connection) {
+		return !connection->online_;
+	});
+
+	forEach(offline.size(), [this, &offline] (size_t i) {
+		auto& connection = *offline.at(i);
+		lock_guard<mutex> guard(connection.mutex_);
+
+		// Someone else could have reconnected it while we waited
+		if (!connection.online_)
+			reconnect(connection);
+	});
+
+	return connections;
+}
+
+// Called with the connection mutex held
+bool SSHPool::reconnect(Connection& connection) {
+	size_t parallel = max(1, Base::config().get<int>("ssh_reconnect_parallel", 8));
+
+	{
+		unique_lock<mutex> lock(reconnect_mutex_);
+		reconnect_condition_.wait(lock, [this, parallel] () { return reconnecting_ < parallel; });
+		reconnecting_++;
+	}
+
+	bool first = !connection.ssh_;
+
+	// Dropping the old master closes what is left of the broken session
+	connection.ssh_.reset(new SSHMaster());
+
+	if (first)
+		enableSSH(connection.ip_);
+
+	bool online = connection.ssh_->connect(connection.ip_, "pass");
+
+	// A rebooted speaker can come back with SSH disabled
+	if (!online && !first) {
+		enableSSH(connection.ip_);
+		online = connection.ssh_->connect(connection.ip_, "pass");
+	}
+
+	{
+		lock_guard<mutex> guard(reconnect_mutex_);
+		reconnecting_--;
+	}
+
+	reconnect_condition_.notify_one();
+
+	connection.last_used_ = chrono::steady_clock::now();
+	connection.online_ = online;
+
+	if (online) {
+		connection.epoch_ = ++epochs_;
+
+		LOG_INFO("Connected to " << connection.ip_ << " (epoch " << connection.epoch_ << ")");
+	} else {
+		LOG_WARNING("speaker " << connection.ip_ << " is not online");
+	}
+
+	return online;
+}
+
+// Called with the connection mutex held
+bool SSHPool::probe(Connection& connection) {
+	connection.ssh_->setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, true);
+	auto output = connection.ssh_->command({ connection.ip_ }, { "true\n" });
+	connection.ssh_->setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, false);
+
+	return !output.empty();
+}
+
+// Called with the connection mutex held
+void SSHPool::used(Connection& connection, bool status) {
+	connection.last_used_ = chrono::steady_clock::now();
+
+	if (status || !connection.online_)
+		return;
+
+	LOG_WARNING("lost SSH connection to " << connection.ip_ << ", reconnecting");
+	connection.online_ = false;
+
+	// Reconnect right away instead of at the next keep-alive
+	{
+		lock_guard<mutex> guard(mutex_);
+		broken_ = true;
+	}
+
+	condition_.notify_all();
+}
+
+vector<bool> SSHPool::connect(const vector<string>& ips) {
+	auto connections = getConnections(ips);
+	vector<bool> online;
+
+	for (auto& connection : connections)
+		online.push_back(connection->online_);
+
+	return online;
+}
+
+SSHOutput SSHPool::command(const vector<string>& ips, const vector<string>& commands) {
+	auto groups = groupByIP(ips);
+	vector<string> unique_ips;
+
+	for (auto& group : groups)
+		unique_ips.push_back(group.first);
+
+	auto connections = getConnections(unique_ips);
+	vector<SSHOutput> outputs(groups.size());
+
+	// Not retried, scripts start playback and recordings
+	forEach(groups.size(), [&] (size_t i) {
+		auto& connection = *connections.at(i);
+		lock_guard<mutex> guard(connection.mutex_);
+
+		if (!connection.online_) {
+			LOG_WARNING("not running script on offline speaker " << connection.ip_);
+
+			return;
+		}
+
+		connection.ssh_->setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, true);
+		outputs.at(i) = connection.ssh_->command(select(ips, groups.at(i).second), select(commands, groups.at(i).second));
+		connection.ssh_->setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, false);
+
+		used(connection, !outputs.at(i).empty());
+	});
+
+	// Back in the order of ips, like SSHMaster
+	SSHOutput output(ips.size());
+
+	for (size_t i = 0; i < groups.size(); i++) {
+		auto& indices = groups.at(i).second;
+
+		if (outputs.at(i).size() != indices.size())
+			return SSHOutput();
+
+		for (size_t j = 0; j < indices.size(); j++)
+			output.at(indices.at(j)) = outputs.at(i).at(j);
+	}
+
+	return output;
+}
+
+bool SSHPool::transfer(const vector<string>& ips, const vector<string>& from, const vector<string>& to, bool overwrite, bool remote) {
+	auto groups = groupByIP(ips);
+	vector<string> unique_ips;
+
+	for (auto& group : groups)
+		unique_ips.push_back(group.first);
+
+	auto connections = getConnections(unique_ips);
+	vector<char> status(groups.size(), false);
+
+	forEach(groups.size(), [&] (size_t i) {
+		auto& connection = *connections.at(i);
+		auto& indices = groups.at(i).second;
+		lock_guard<mutex> guard(connection.mutex_);
+
+		// Transfers can be repeated, a connection which broke since the last use gets one more try
+		for (int attempt = 0; attempt < 2 && !status.at(i); attempt++) {
+			if (!connection.online_ && !reconnect(connection))
+				return;
+
+			bool transferred;
+
+			if (remote)
+				transferred = connection.ssh_->transferRemote(select(ips, indices), select(from, indices), select(to, indices), overwrite);
+			else
+				transferred = connection.ssh_->transferLocal(select(ips, indices), select(from, indices), select(to, indices), overwrite);
+
+			used(connection, transferred);
+			status.at(i) = transferred;
+		}
+	});
+
+	return all_of(status.begin(), status.end(), [] (char transferred) { return transferred; });
+}
+
+bool SSHPool::transferRemote(const vector<string>& ips, const vector<string>& from, const vector<string>& to, bool overwrite) {
+	return transfer(ips, from, to, overwrite, true);
+}
+
+bool SSHPool::transferLocal(const vector<string>& ips, const vector<string>& from, const vector<string>& to, bool overwrite) {
+	return transfer(ips, from, to, overwrite, false);
+}
+
+bool SSHPool::isOnline(const string& ip) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = connections_.find(ip);
+
+	return iterator != connections_.end() && iterator->second->online_;
+}
+
+unsigned int SSHPool::getEpoch(const string& ip) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = connections_.find(ip);
+
+	if (iterator == connections_.end() || !iterator->second->online_)
+		return 0;
+
+	return iterator->second->epoch_;
+}
+
+bool SSHPool::hasFile(const string& ip, const string& path, const FileChecksum& checksum) {
+	lock_guard<mutex> guard(mutex_);
+	auto connection = connections_.find(ip);
+	auto file = files_.find({ ip, path });
+
+	if (connection == connections_.end() || file == files_.end() || !connection->second->online_)
+		return false;
+
+	return file->second.second == connection->second->epoch_ && file->second.first == checksum;
+}
+
+void SSHPool::setFile(const string& ip, const string& path, const FileChecksum& checksum, unsigned int epoch) {
+	lock_guard<mutex> guard(mutex_);
+
+	files_[{ ip, path }] = { checksum, epoch };
+}
+
+void SSHPool::run() {
+	unique_lock<mutex> lock(mutex_);
+
+	while (true) {
+		auto keepalive = chrono::seconds(Base::config().get<int>("ssh_keepalive", 30));
+		condition_.wait_for(lock, keepalive, [this] () { return stop_ || broken_; });
+
+		if (stop_)
+			break;
+
+		broken_ = false;
+		Connections connections;
+
+		for (auto& connection : connections_)
+			connections.push_back(connection.second);
+
+		lock.unlock();
+
+		forEach(connections.size(), [this, &connections, keepalive] (size_t i) {
+			auto& connection = *connections.at(i);
+			unique_lock<mutex> guard(connection.mutex_, try_to_lock);
+
+			// Whoever is using it notices if it's broken
+			if (!guard.owns_lock())
+				return;
+
+			if (connection.online_) {
+				if (chrono::steady_clock::now() - connection.last_used_ < keepalive)
+					return;
+
+				if (probe(connection)) {
+					connection.last_used_ = chrono::steady_clock::now();
+
+					return;
+				}
+
+				LOG_WARNING("lost SSH connection to " << connection.ip_ << ", reconnecting");
+				connection.online_ = false;
+			}
+
+			reconnect(connection);
+		});
+
+		lock.lock();
+	}
+}
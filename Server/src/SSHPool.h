@@ -0,0 +1,88 @@
+#pragma once
+#ifndef SSH_POOL_H
+#define SSH_POOL_H
+
+#include "DeviceBackend.h"
+
+// libnessh
+#include <libnessh/SSHMaster.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+/*
+	SSH connections to the speakers, one per speaker and shared by all sessions for as long as
+	the server runs. A background thread probes connections which have been idle for
+	ssh_keepalive seconds, so a speaker that rebooted is reconnected before the next request
+	instead of failing it. Broken connections are reconnected ssh_reconnect_parallel at a time.
+
+	Every successful connect gives the speaker a new epoch, anything cached about the state of
+	a speaker (e.g. uploaded files) is only valid for the epoch it was seen in. A reboot clears
+	/tmp and always means a new connection.
+*/
+class SSHPool : public DeviceBackend {
+public:
+	SSHPool();
+	~SSHPool();
+
+	std::vector<bool> connect(const std::vector<std::string>& ips) override;
+
+	// Same as SSHMaster
+	SSHOutput command(const std::vector<std::string>& ips, const std::vector<std::string>& commands) override;
+	bool transferRemote(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) override;
+	bool transferLocal(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) override;
+
+	bool isOnline(const std::string& ip) override;
+	unsigned int getEpoch(const std::string& ip) override;
+
+	bool hasFile(const std::string& ip, const std::string& path, const FileChecksum& checksum) override;
+	void setFile(const std::string& ip, const std::string& path, const FileChecksum& checksum, unsigned int epoch) override;
+
+private:
+	struct Connection {
+		std::string ip_;
+		std::unique_ptr<SSHMaster> ssh_;
+		std::atomic<bool> online_;
+		std::atomic<unsigned int> epoch_;
+
+		// Held while the connection is used
+		std::mutex mutex_;
+		std::chrono::steady_clock::time_point last_used_;
+	};
+
+	using Connections = std::vector<std::shared_ptr<Connection>>;
+
+	Connections getConnections(const std::vector<std::string>& ips);
+	bool reconnect(Connection& connection);
+	bool probe(Connection& connection);
+	void used(Connection& connection, bool status);
+
+	// Runs transfer once per speaker with all files of that speaker, reconnects and retries the failed ones once
+	bool transfer(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite, bool remote);
+
+	void run();
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::map<std::string, std::shared_ptr<Connection>> connections_;
+	std::map<std::pair<std::string, std::string>, std::pair<FileChecksum, unsigned int>> files_;
+	std::atomic<unsigned int> epochs_;
+	bool broken_ = false;
+	bool stop_ = false;
+
+	std::mutex reconnect_mutex_;
+	std::condition_variable reconnect_condition_;
+	size_t reconnecting_ = 0;
+
+	// Started on first use, after the config is read
+	std::thread thread_;
+};
+
+#endif
@@ -6,112 +6,244 @@
 #include "Config.h"
 #include "Profile.h"
 #include "System.h"
+#include "ResultsStore.h"
+#include "JobExecutor.h"
+#include "Session.h"
+#include "Log.h"
 
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <map>
+#include <memory>
+#include <chrono>
 
 // libcurlpp
 #include <curlpp/cURLpp.hpp>
 
 using namespace std;
 
-enum {
-	PACKET_START_LOCALIZATION = 1,
-	PACKET_CHECK_SPEAKERS_ONLINE,
-	PACKET_CHECK_SOUND_IMAGE,
-	PACKET_CHECK_SOUND_IMAGE_WHITE,
-	PACKET_SET_BEST_EQ,
-	PACKET_SET_EQ_STATUS,
-	PACKET_RESET_EVERYTHING,
-	PACKET_SET_SOUND_EFFECTS,
-	PACKET_TESTING
+extern vector<double> g_customer_profile;
+
+struct NamedSession {
+	shared_ptr<Session> session_;
+	chrono::steady_clock::time_point used_;
 };
 
-extern Connection* g_current_connection;
-extern vector<double> g_customer_profile;
+// By the name the client joined with, so speakers and placements are still there when it reconnects
+static map<string, NamedSession> g_sessions;
+// Connections which never named a session share the default one
+static map<size_t, string> g_connection_sessions;
 
-static void handle(Connection& connection, Packet& input_packet) {
-	g_current_connection = &connection;
+static const string DEFAULT_SESSION = "default";
+
+// Forgets sessions idle for session_idle_timeout seconds, unless they still have jobs
+static void evictSessions() {
+	auto timeout = chrono::seconds(Base::config().get<int>("session_idle_timeout"));
+	auto now = chrono::steady_clock::now();
+
+	for (auto iterator = g_sessions.begin(); iterator != g_sessions.end(); ) {
+		if (now - iterator->second.used_ < timeout || Base::jobs().hasJobs(iterator->second.session_.get())) {
+			iterator++;
+
+			continue;
+		}
+
+		LOG_INFO("Evicting idle session " << iterator->first);
+		iterator = g_sessions.erase(iterator);
+	}
+
+	for (auto iterator = g_connection_sessions.begin(); iterator != g_connection_sessions.end(); ) {
+		if (g_sessions.count(iterator->second))
+			iterator++;
+		else
+			iterator = g_connection_sessions.erase(iterator);
+	}
+}
+
+static shared_ptr<Session> getSession(Connection& connection) {
+	auto name = g_connection_sessions.find(connection.getId());
+	auto& session = g_sessions[name == g_connection_sessions.end() ? DEFAULT_SESSION : name->second];
+
+	if (!session.session_)
+		session.session_ = make_shared<Session>();
+
+	session.used_ = chrono::steady_clock::now();
+
+	return session.session_;
+}
+
+static vector<string> getIPs(Packet& packet) {
+	int num_ips = packet.getInt();
+	vector<string> ips;
+
+	for (int i = 0; i < num_ips; i++)
+		ips.push_back(packet.getString());
+
+	return ips;
+}
+
+static void addPlacements(Packet& packet, const PlacementOutput& placements) {
+	packet.addInt(placements.size());
+
+	for (auto& speaker : placements) {
+		packet.addString(get<0>(speaker));
+
+		auto& coordinates = get<1>(speaker);
+		packet.addInt(coordinates.size());
+		for_each(coordinates.begin(), coordinates.end(), [&packet] (double c) { packet.addFloat(c); });
+
+		auto& distances = get<2>(speaker);
+		packet.addInt(distances.size());
+		for_each(distances.begin(), distances.end(), [&packet] (const pair<string, double>& peer) {
+			packet.addString(peer.first);
+			packet.addFloat(peer.second);
+		});
+	}
+}
+
+// Everything touching speakers or session settings is answered with a job ID and run by the job executor
+static bool isJob(unsigned char header) {
+	switch (header) {
+		case PACKET_START_LOCALIZATION:
+		case PACKET_CHECK_SPEAKERS_ONLINE:
+		case PACKET_CHECK_SOUND_IMAGE:
+		case PACKET_VERIFY_SOUND_IMAGE:
+		case PACKET_SET_EQ_STATUS:
+		case PACKET_RESET_EVERYTHING:
+		case PACKET_SET_SOUND_EFFECTS:
+		case PACKET_TESTING:
+		case PACKET_SET_SETTING:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+// Profiles of the current session from its config
+static void setProfiles() {
+	auto low_cutoff = Base::config().get<double>("hardware_profile_cutoff_low");
+	auto high_cutoff = Base::config().get<double>("hardware_profile_cutoff_high");
+
+	// Set profiles here for now
+	Profile speaker;
+	speaker.setCutoffs(low_cutoff, high_cutoff);
+
+	Profile microphone;
+	microphone.setCutoffs(low_cutoff, high_cutoff);
+
+	// / 2.0 since we're doing shelf filter instead of steeping
+	// Bring back steeping
+	auto steep_low = Base::config().get<double>("hardware_profile_steep_low");//; / 2.0;
+	auto steep_high = Base::config().get<double>("hardware_profile_steep_high");// / 2.0;
+
+	speaker.setSteep(steep_low, steep_high);
+	microphone.setSteep(steep_low, steep_high);
+
+	vector<double> frequencies = Base::config().getAll<double>("dsp_eq"); //{ 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	double q = Base::config().get<double>("dsp_eq_q");
+	auto string_type = Base::config().get<string>("dsp_eq_type");
+	int type = 0;
+	if (string_type == "parametric") {
+		type = PARAMETRIC;
+	} else if (string_type == "graphic") {
+		type = GRAPHIC;
+	} else if (string_type == "low_shelf") {
+		type = LOW_SHELF;
+	} else if (string_type == "high_shelf") {
+		type = HIGH_SHELF;
+	} else if (string_type == "low_pass") {
+		type = LOW_PASS;
+	} else if (string_type == "high_pass") {
+		type = HIGH_PASS;
+	} else if (string_type == "band_pass") {
+		type = BAND_PASS;
+	}
+
+	speaker.setSpeakerEQ(frequencies, q);
+	speaker.setMaxEQ(Base::config().get<double>("dsp_eq_max"));
+	speaker.setMinEQ(Base::config().get<double>("dsp_eq_min"));
+
+	for (size_t i = 0; i < frequencies.size(); i++)
+		speaker.getFilter().addBand(lround(frequencies.at(i)), q, type);
+
+	Base::system().setSpeakerProfile(speaker);
+	Base::system().setMicrophoneProfile(microphone);
+}
 
+static void handle(Connection& connection, Packet& input_packet) {
 	auto header = input_packet.getByte();
+	auto socket = connection.getSocket();
+
+	evictSessions();
+
+	// The name packet picks the session, everything after it goes there
+	shared_ptr<Session> session;
+
+	if (header != PACKET_JOIN_SESSION)
+		session = getSession(connection);
 
 	printf("Debug: got packet with header %02X\n", header);
 
 	Packet packet;
-	packet.addHeader(header);
+	packet.addHeader(isJob(header) ? static_cast<unsigned char>(PACKET_JOB_STARTED) : header);
 
 	switch (header) {
-		case 0x00: {
+		case PACKET_JOIN_SESSION: {
 			string name = input_packet.getString();
-			cout << "Information: client name is " << name << endl;
+			LOG_INFO("Client joined session " << name);
+
+			g_connection_sessions[connection.getId()] = name;
+			getSession(connection);
 
 			packet.addBool(true);
 			break;
 		}
 
 		case PACKET_START_LOCALIZATION: {
-			vector<string> ips;
 			bool force_update = input_packet.getBool();
-			int num_ips = input_packet.getInt();
-
-			for (int i = 0; i < num_ips; i++)
-				ips.push_back(input_packet.getString());
+			auto ips = getIPs(input_packet);
 
-			auto placements = Handle::runLocalization(ips, force_update);
-
-			packet.addInt(placements.size());
-
-			for (auto& speaker : placements) {
-				packet.addString(get<0>(speaker));
-
-				auto& coordinates = get<1>(speaker);
-				packet.addInt(coordinates.size());
-				for_each(coordinates.begin(), coordinates.end(), [&packet] (double c) { packet.addFloat(c); });
-
-				auto& distances = get<2>(speaker);
-				packet.addInt(distances.size());
-				for_each(distances.begin(), distances.end(), [&packet] (const pair<string, double>& peer) {
-					packet.addString(peer.first);
-					packet.addFloat(peer.second);
-				});
-			}
+			auto id = Base::jobs().submit(socket, header, "localization", session, ips, [ips, force_update] (Packet& reply) {
+				addPlacements(reply, Handle::runLocalization(ips, force_update));
+			});
 
+			packet.addInt(id);
 			break;
 		}
 
 		case PACKET_RESET_EVERYTHING: {
-			int num_speakers = input_packet.getInt();
-			vector<string> ips;
+			auto ips = getIPs(input_packet);
 
-			for (int i = 0; i < num_speakers; i++)
-				ips.push_back(input_packet.getString());
-
-			Handle::resetIPs(ips);
+			auto id = Base::jobs().submit(socket, header, "reset", session, ips, [ips] (Packet&) {
+				Handle::resetIPs(ips);
+			});
 
+			packet.addInt(id);
 			break;
 		}
 
 		case PACKET_CHECK_SPEAKERS_ONLINE: {
-			int num_speakers = input_packet.getInt();
-			vector<string> ips;
+			auto ips = getIPs(input_packet);
 
-			for (int i = 0; i < num_speakers; i++)
-				ips.push_back(input_packet.getString());
+			auto id = Base::jobs().submit(socket, header, "speakers online", session, ips, [ips] (Packet& reply) {
+				auto answer = Handle::checkSpeakersOnline(ips);
 
-			auto answer = Handle::checkSpeakersOnline(ips);
+				reply.addInt(ips.size());
 
-			packet.addInt(num_speakers);
-
-			for (int i = 0; i < num_speakers; i++) {
-				packet.addString(ips.at(i));
-				packet.addBool(answer.at(i));
-			}
+				for (size_t i = 0; i < ips.size(); i++) {
+					reply.addString(ips.at(i));
+					reply.addBool(answer.at(i));
+				}
+			});
 
+			packet.addInt(id);
 			break;
 		}
 
-		case PACKET_CHECK_SOUND_IMAGE: {
+		case PACKET_CHECK_SOUND_IMAGE:
+		case PACKET_VERIFY_SOUND_IMAGE: {
 			vector<string> speakers;
 			vector<string> mics;
 			vector<double> gains;
@@ -131,8 +263,27 @@ static void handle(Connection& connection, Packet& input_packet) {
 			for (int i = 0; i < num_gains; i++)
 				gains.push_back(input_packet.getFloat());
 
-			Handle::checkSoundImage(speakers, mics, gains, factor_calibration, type);
+			// Microphones are speakers too
+			auto ips = speakers;
+			ips.insert(ips.end(), mics.begin(), mics.end());
+
+			bool verify = header == PACKET_VERIFY_SOUND_IMAGE;
 
+			auto id = Base::jobs().submit(socket, header, verify ? "verify sound image" : "sound image", session, ips, [speakers, mics, gains, factor_calibration, type, verify] (Packet& reply) {
+				if (!verify) {
+					Handle::checkSoundImage(speakers, mics, gains, factor_calibration, type);
+
+					return;
+				}
+
+				// The speakers that were calibrated again
+				auto drifted = Handle::verifySoundImage(speakers, mics, gains, factor_calibration, type);
+
+				reply.addInt(drifted.size());
+				for_each(drifted.begin(), drifted.end(), [&reply] (const string& ip) { reply.addString(ip); });
+			});
+
+			packet.addInt(id);
 			break;
 		}
 
@@ -144,39 +295,92 @@ static void handle(Connection& connection, Packet& input_packet) {
 
 		case PACKET_SET_EQ_STATUS: {
 			bool status = input_packet.getBool();
-			int num = input_packet.getInt();
-			vector<string> speakers;
+			auto speakers = getIPs(input_packet);
 
-			for (int i = 0; i < num; i++)
-				speakers.push_back(input_packet.getString());
-
-			Handle::setEQStatus(speakers, status);
+			auto id = Base::jobs().submit(socket, header, "EQ status", session, speakers, [speakers, status] (Packet&) {
+				Handle::setEQStatus(speakers, status);
+			});
 
+			packet.addInt(id);
 			break;
 		}
 
 		case PACKET_SET_SOUND_EFFECTS: {
 			bool status = input_packet.getBool();
-			int num = input_packet.getInt();
-			vector<string> speakers;
+			auto speakers = getIPs(input_packet);
 
-			for (int i = 0; i < num; i++)
-				speakers.push_back(input_packet.getString());
+			auto id = Base::jobs().submit(socket, header, "sound effects", session, speakers, [speakers, status] (Packet&) {
+				Handle::setSoundEffects(speakers, status);
+			});
+
+			packet.addInt(id);
+			break;
+		}
+
+		case PACKET_TESTING: {
+			auto id = Base::jobs().submit(socket, header, "testing", session, {}, [] (Packet&) {
+				Handle::testing();
+			});
+
+			packet.addInt(id);
+			break;
+		}
+
+		// Changes a config value for this session only, e.g. another speaker_profile or dsp_eq_max
+		case PACKET_SET_SETTING: {
+			string key = input_packet.getString();
+			int num_values = input_packet.getInt();
+			deque<string> values;
+
+			for (int i = 0; i < num_values; i++)
+				values.push_back(input_packet.getString());
+
+			// As a job so running jobs of this session keep their settings
+			auto id = Base::jobs().submit(socket, header, "setting " + key, session, {}, [key, values] (Packet& reply) {
+				Base::config().internal()[key] = values;
+
+				if (key.compare(0, 6, "dsp_eq") == 0 || key.compare(0, 17, "hardware_profile_") == 0)
+					setProfiles();
+
+				reply.addString(key);
+			});
+
+			packet.addInt(id);
+			break;
+		}
+
+		case PACKET_JOB_STATUS: {
+			int id = input_packet.getInt();
+			JobStatus status;
 
-			Handle::setSoundEffects(speakers, status);
+			// Unknown jobs are reported as failed
+			if (!Base::jobs().getStatus(id, status))
+				status.state_ = JOB_FAILED;
+
+			packet.addInt(id);
+			packet.addInt(status.state_);
+			packet.addString(status.stage_);
+			packet.addString(status.speaker_);
+			packet.addFloat(status.percent_);
 
 			break;
 		}
 
-		case PACKET_TESTING: Handle::testing();
+		case PACKET_JOB_CANCEL: {
+			int id = input_packet.getInt();
+
+			packet.addInt(id);
+			packet.addBool(Base::jobs().cancel(id));
+
 			break;
+		}
 
 		default:	cout << "Debug: got some random packet, answering with empty packet\n";
 					cout << "Debug: header " << header << endl;
 	}
 
 	packet.finalize();
-	Base::network().addOutgoingPacket(connection.getSocket(), packet);
+	Base::network().addOutgoingPacket(socket, packet);
 }
 
 static void start() {
@@ -206,57 +410,15 @@ static void start() {
 
 int main() {
 	Base::config().parse("config");
+	Log::setLevel(Base::config().get<string>("log_level", "info"));
 
-	auto low_cutoff = Base::config().get<double>("hardware_profile_cutoff_low");
-	auto high_cutoff = Base::config().get<double>("hardware_profile_cutoff_high");
-
-	// Set profiles here for now
-	Profile speaker;
-	speaker.setCutoffs(low_cutoff, high_cutoff);
-
-	Profile microphone;
-	microphone.setCutoffs(low_cutoff, high_cutoff);
-
-	// / 2.0 since we're doing shelf filter instead of steeping
-	// Bring back steeping
-	auto steep_low = Base::config().get<double>("hardware_profile_steep_low");//; / 2.0;
-	auto steep_high = Base::config().get<double>("hardware_profile_steep_high");// / 2.0;
-
-	speaker.setSteep(steep_low, steep_high);
-	microphone.setSteep(steep_low, steep_high);
-
-	vector<double> frequencies = Base::config().getAll<double>("dsp_eq"); //{ 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
-	double q = Base::config().get<double>("dsp_eq_q");
-	auto string_type = Base::config().get<string>("dsp_eq_type");
-	int type = 0;
-	if (string_type == "parametric") {
-		type = PARAMETRIC;
-	} else if (string_type == "graphic") {
-		type = GRAPHIC;
-	} else if (string_type == "low_shelf") {
-		type = LOW_SHELF;
-	} else if (string_type == "high_shelf") {
-		type = HIGH_SHELF;
-	} else if (string_type == "low_pass") {
-		type = LOW_PASS;
-	} else if (string_type == "high_pass") {
-		type = HIGH_PASS;
-	} else if (string_type == "band_pass") {
-		type = BAND_PASS;
-	}
-
-	speaker.setSpeakerEQ(frequencies, q);
-	speaker.setMaxEQ(Base::config().get<double>("dsp_eq_max"));
-	speaker.setMinEQ(Base::config().get<double>("dsp_eq_min"));
-
-	for (size_t i = 0; i < frequencies.size(); i++)
-		speaker.getFilter().addBand(lround(frequencies.at(i)), q, type);
-
-	Base::system().setSpeakerProfile(speaker);
-	Base::system().setMicrophoneProfile(microphone);
+	setProfiles();
 
 	g_customer_profile = Base::config().getAll<double>("customer_profile");
 
+	// Runs are still calibrated without it, they just aren't saved
+	Base::results().open(Base::config().get<string>("results_store"));
+
 	// For testing
 	if (Base::config().get<bool>("enable_testing")) {
 		Handle::testing();
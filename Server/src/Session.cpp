@@ -0,0 +1,29 @@
+#include "Session.h"
+#include "Base.h"
+
+#include <atomic>
+
+static std::atomic<unsigned int> g_session_ids(0);
+
+Session::Session() :
+	id_(++g_session_ids),
+	config_(Base::config()) {
+	system_.setSpeakerProfile(Base::system().getSpeakerProfile());
+	system_.setMicrophoneProfile(Base::system().getMicrophoneProfile());
+}
+
+System& Session::getSystem() {
+	return system_;
+}
+
+Config& Session::getConfig() {
+	return config_;
+}
+
+Trace& Session::getTrace() {
+	return trace_;
+}
+
+unsigned int Session::getID() const {
+	return id_;
+}
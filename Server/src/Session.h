@@ -0,0 +1,39 @@
+#pragma once
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "System.h"
+#include "Config.h"
+#include "Trace.h"
+
+/*
+	Settings and speakers of one client. Each session has its own System, so its own speakers
+	and profiles, and its own copy of the config which the client can change without affecting
+	anyone else. Connections to the speakers are shared by all sessions, see Base::devices().
+	Jobs of different sessions run at the same time as long as they don't share speakers, see
+	JobExecutor.
+
+	The session of a thread is g_session in Base.h. Threads started with std::thread have to
+	set it themselves, OpenMP regions which reach Base:: (config, system, trace, ...) copy it in
+	with copyin(g_session) while purely numerical regions don't need it.
+*/
+class Session {
+public:
+	// Starts from the server config and profiles, construct it outside of jobs
+	Session();
+
+	System& getSystem();
+	Config& getConfig();
+	Trace& getTrace();
+
+	// Unique while the server runs, e.g. for files of the session
+	unsigned int getID() const;
+
+private:
+	unsigned int id_;
+	System system_;
+	Config config_;
+	Trace trace_;
+};
+
+#endif
@@ -0,0 +1,476 @@
+#include "SimulatedDevices.h"
+#include "Base.h"
+#include "Config.h"
+#include "Log.h"
+#include "FilterBank.h"
+#include "Sweep.h"
+#include "WavReader.h"
+
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+static const double SAMPLE_RATE = 48000;
+static const double SPEED_OF_SOUND = 343;
+
+// A speaker recording itself, the microphone sits right next to the driver
+static const double SELF_DISTANCE = 0.05;
+// Samples between the direct sound and the diffuse tail
+static const size_t REFLECTION_DELAY = 48;
+// One pole low pass of the tail, the air and the walls take the highs first
+static const double DAMPING = 0.5;
+
+// FNV-1a, so every speaker gets the same place and room every run
+static unsigned int getSeed(const string& value) {
+	unsigned int hash = 2166136261u;
+
+	for (auto character : value) {
+		hash ^= static_cast<unsigned char>(character);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Uploads always go to a directory
+static string getRemotePath(const string& from, const string& to) {
+	auto name = from.substr(from.find_last_of('/') + 1);
+
+	return to.empty() || to.back() == '/' ? to + name : to + "/" + name;
+}
+
+// Statements of a script and whether they run in the background
+static vector<pair<string, bool>> getStatements(const string& script) {
+	vector<pair<string, bool>> statements;
+	string statement;
+
+	for (size_t i = 0; i < script.size(); i++) {
+		char character = script[i];
+
+		// Redirections like 2>&1 are part of the statement
+		if (character == '&' && !statement.empty() && statement.back() == '>') {
+			statement += character;
+
+			continue;
+		}
+
+		if (character != ';' && character != '\n' && character != '&') {
+			statement += character;
+
+			continue;
+		}
+
+		bool background = false;
+
+		// && runs in order like ;
+		if (character == '&') {
+			if (i + 1 < script.size() && script[i + 1] == '&')
+				i++;
+			else
+				background = true;
+		}
+
+		if (statement.find_first_not_of(" \t") != string::npos)
+			statements.push_back({ statement, background });
+
+		statement.clear();
+	}
+
+	if (statement.find_first_not_of(" \t") != string::npos)
+		statements.push_back({ statement, false });
+
+	return statements;
+}
+
+static vector<string> getTokens(const string& statement) {
+	istringstream stream(statement);
+	vector<string> tokens;
+	string token;
+
+	while (stream >> token)
+		tokens.push_back(token);
+
+	return tokens;
+}
+
+// Value following option, empty if there is none
+static string getOption(const vector<string>& tokens, const string& option) {
+	auto iterator = find(tokens.begin(), tokens.end(), option);
+
+	if (iterator == tokens.end() || iterator + 1 == tokens.end())
+		return "";
+
+	return *(iterator + 1);
+}
+
+// Comma separated like dspd takes them
+static vector<double> getValues(const string& list) {
+	istringstream stream(list);
+	vector<double> values;
+	string value;
+
+	while (getline(stream, value, ','))
+		values.push_back(atof(value.c_str()));
+
+	return values;
+}
+
+vector<bool> SimulatedDevices::connect(const vector<string>& ips) {
+	return vector<bool>(ips.size(), true);
+}
+
+SSHOutput SimulatedDevices::command(const vector<string>& ips, const vector<string>& commands) {
+	auto started = chrono::steady_clock::now();
+
+	vector<Playback> playbacks;
+	vector<Recording> recordings;
+	SSHOutput outputs;
+	double duration = 0;
+
+	{
+		// Everything in one command starts at the same time, like the SSH commands do
+		lock_guard<mutex> guard(mutex_);
+
+		for (size_t i = 0; i < ips.size(); i++) {
+			duration = max(duration, interpret(ips.at(i), commands.at(i), playbacks, recordings));
+			outputs.push_back({ ips.at(i), {} });
+		}
+	}
+
+	// What comes out of the speakers, then what every microphone gets of it
+	vector<vector<double>> played(playbacks.size());
+	vector<vector<short>> recorded(recordings.size());
+
+	#pragma omp parallel for copyin(g_session)
+	for (size_t i = 0; i < playbacks.size(); i++)
+		played[i] = play(playbacks[i]);
+
+	#pragma omp parallel for copyin(g_session)
+	for (size_t i = 0; i < recordings.size(); i++)
+		recorded[i] = record(recordings[i], playbacks, played);
+
+	{
+		lock_guard<mutex> guard(mutex_);
+
+		for (size_t i = 0; i < recordings.size(); i++)
+			recordings_[{ recordings[i].ip_, recordings[i].path_ }] = move(recorded[i]);
+	}
+
+	LOG_DEBUG("Simulated " << playbacks.size() << " playbacks and " << recordings.size() << " recordings over " << duration << " s");
+
+	if (Base::config().get<bool>("simulated_realtime"))
+		this_thread::sleep_until(started + chrono::milliseconds(lround(duration * 1000)));
+
+	return outputs;
+}
+
+double SimulatedDevices::interpret(const string& ip, const string& script, vector<Playback>& playbacks, vector<Recording>& recordings) {
+	double time = 0;
+	double background = 0;
+
+	for (auto& statement : getStatements(script)) {
+		auto tokens = getTokens(statement.first);
+		auto& program = tokens.front();
+		double duration = 0;
+
+		if (statement.first.find('|') != string::npos) {
+			LOG_WARNING("simulated " << ip << " does not run pipes: " << statement.first);
+
+			continue;
+		}
+
+		if (program == "wait") {
+			time = max(time, background);
+
+			continue;
+		}
+
+		if (program == "sleep" && tokens.size() > 1) {
+			duration = atof(tokens.at(1).c_str());
+		} else if (program == "aplay") {
+			auto file = files_.find({ ip, tokens.back() });
+
+			if (file == files_.end()) {
+				LOG_WARNING("simulated " << ip << " has no " << tokens.back() << " to play");
+
+				continue;
+			}
+
+			playbacks.push_back({ ip, time, file->second, equalizers_[ip] });
+			duration = file->second->size() / SAMPLE_RATE;
+		} else if (program == "arecord") {
+			duration = atof(getOption(tokens, "-d").c_str());
+			recordings.push_back({ ip, tokens.back(), time, static_cast<size_t>(lround(duration * SAMPLE_RATE)) });
+		} else if (program == "dspd") {
+			auto gains = getValues(getOption(tokens, "-e"));
+			auto frequencies = getValues(getOption(tokens, "-f"));
+
+			if (!getOption(tokens, "-w").empty()) {
+				// Presets are flat
+				equalizers_[ip] = Equalizer();
+			} else if (!gains.empty() && gains.size() == frequencies.size()) {
+				Equalizer eq;
+				eq.gains_ = gains;
+				eq.q_ = getOption(tokens, "-a").empty() ? 1 : atof(getOption(tokens, "-a").c_str());
+
+				for (auto frequency : frequencies)
+					eq.frequencies_.push_back(lround(frequency));
+
+				equalizers_[ip] = eq;
+			} else if (!gains.empty()) {
+				LOG_WARNING("simulated " << ip << " got " << gains.size() << " EQ gains for " << frequencies.size() << " frequencies");
+			}
+		}
+
+		if (statement.second)
+			background = max(background, time + duration);
+		else
+			time += duration;
+	}
+
+	return max(time, background);
+}
+
+// The EQ is applied like the DSP does, one parametric filter per band
+vector<double> SimulatedDevices::play(const Playback& playback) {
+	const auto& eq = playback.eq_;
+	const auto* samples = playback.signal_.get();
+	vector<short> filtered;
+
+	if (any_of(eq.gains_.begin(), eq.gains_.end(), [] (double gain) { return gain != 0; })) {
+		FilterBank filter;
+		vector<pair<int, double>> gains;
+
+		for (size_t i = 0; i < eq.gains_.size(); i++) {
+			filter.addBand(eq.frequencies_.at(i), eq.q_, PARAMETRIC);
+			gains.push_back({ eq.frequencies_.at(i), eq.gains_.at(i) });
+		}
+
+		filter.apply(*samples, filtered, gains, SAMPLE_RATE, true);
+		samples = &filtered;
+	}
+
+	vector<double> output(samples->size());
+
+	for (size_t i = 0; i < output.size(); i++)
+		output[i] = static_cast<double>(samples->at(i)) / SHRT_MAX;
+
+	return output;
+}
+
+vector<short> SimulatedDevices::record(const Recording& recording, const vector<Playback>& playbacks, const vector<vector<double>>& played) {
+	vector<double> mixed(recording.samples_, 0);
+	long size = mixed.size();
+
+	for (size_t j = 0; j < playbacks.size(); j++) {
+		const auto& impulse_response = getImpulseResponse(playbacks[j].ip_, recording.ip_);
+		long offset = lround((playbacks[j].start_ - recording.start_) * SAMPLE_RATE);
+
+		// Played before or after the recording
+		if (offset >= size || offset + static_cast<long>(played[j].size() + impulse_response.size()) <= 0)
+			continue;
+
+		auto arriving = nac::convolve(played[j], impulse_response);
+
+		for (size_t i = 0; i < arriving.size(); i++) {
+			long position = offset + static_cast<long>(i);
+
+			if (position >= 0 && position < size)
+				mixed[position] += arriving[i];
+		}
+	}
+
+	unsigned int seed;
+
+	{
+		// Different noise in every recording
+		lock_guard<mutex> guard(mutex_);
+		seed = getSeed(recording.ip_) + recorded_++;
+	}
+
+	mt19937 generator(seed);
+	normal_distribution<double> noise(0, pow(10, Base::config().get<double>("simulated_noise_level") / 20));
+	vector<short> samples(mixed.size());
+
+	for (size_t i = 0; i < mixed.size(); i++) {
+		double value = (mixed[i] + noise(generator)) * SHRT_MAX;
+
+		samples[i] = static_cast<short>(max<double>(SHRT_MIN, min<double>(SHRT_MAX, lround(value))));
+	}
+
+	return samples;
+}
+
+const vector<double>& SimulatedDevices::getImpulseResponse(const string& speaker, const string& mic) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = impulse_responses_.find({ speaker, mic });
+
+	if (iterator == impulse_responses_.end())
+		iterator = impulse_responses_.insert({ { speaker, mic }, createImpulseResponse(speaker, mic) }).first;
+
+	return iterator->second;
+}
+
+vector<double> SimulatedDevices::createImpulseResponse(const string& speaker, const string& mic) {
+	if (Base::config().has("simulated_impulse_responses")) {
+		auto file = Base::config().get<string>("simulated_impulse_responses") + "/" + speaker + "_" + mic + ".wav";
+
+		if (access(file.c_str(), R_OK) == 0) {
+			vector<short> samples;
+			WavReader::read(file, samples);
+
+			vector<double> impulse_response(samples.size());
+
+			for (size_t i = 0; i < samples.size(); i++)
+				impulse_response[i] = static_cast<double>(samples[i]) / SHRT_MAX;
+
+			return impulse_response;
+		}
+
+		LOG_WARNING("no measured impulse response " << file << ", simulating the room instead");
+	}
+
+	auto from = getPosition(speaker);
+	auto to = getPosition(mic);
+	double distance = SELF_DISTANCE;
+
+	if (speaker != mic)
+		distance = max(SELF_DISTANCE, sqrt(pow(from[0] - to[0], 2) + pow(from[1] - to[1], 2) + pow(from[2] - to[2], 2)));
+
+	double rt60 = max(0.01, Base::config().get<double>("simulated_rt60"));
+	size_t delay = lround(distance / SPEED_OF_SOUND * SAMPLE_RATE);
+	size_t tail = lround(rt60 * SAMPLE_RATE);
+
+	vector<double> impulse_response(delay + REFLECTION_DELAY + tail, 0);
+
+	// Inverse distance law from 1 m
+	impulse_response[delay] = 1 / max(distance, 1.0);
+
+	// Diffuse tail with the energy of the direct sound at 1 m, 60 dB down after rt60
+	double level = sqrt(2 * log(1000) / (rt60 * SAMPLE_RATE)) * sqrt((2 - DAMPING) / DAMPING);
+	double damped = 0;
+
+	mt19937 generator(getSeed(speaker + " " + mic));
+	normal_distribution<double> noise(0, 1);
+
+	for (size_t i = 0; i < tail; i++) {
+		damped += DAMPING * (noise(generator) - damped);
+
+		impulse_response[delay + REFLECTION_DELAY + i] = level * exp(-log(1000) * i / (rt60 * SAMPLE_RATE)) * damped;
+	}
+
+	return impulse_response;
+}
+
+// Somewhere in the room, always the same place for the same IP
+array<double, 3> SimulatedDevices::getPosition(const string& ip) {
+	auto size = Base::config().getAll<double>("simulated_room_size");
+
+	if (size.size() != 3)
+		size = { 6, 4, 2.5 };
+
+	mt19937 generator(getSeed(ip));
+	uniform_real_distribution<double> unit(0, 1);
+	array<double, 3> position;
+
+	for (size_t i = 0; i < position.size(); i++)
+		position[i] = unit(generator) * size[i];
+
+	return position;
+}
+
+bool SimulatedDevices::transferRemote(const vector<string>& ips, const vector<string>& from, const vector<string>& to, bool overwrite) {
+	// Read once however many speakers get the same file, the speakers keep what they got
+	map<string, Signal> uploads;
+
+	for (size_t i = 0; i < ips.size(); i++) {
+		auto path = getRemotePath(from.at(i), to.at(i));
+
+		{
+			lock_guard<mutex> guard(mutex_);
+
+			if (!overwrite && files_.count({ ips.at(i), path }))
+				continue;
+		}
+
+		auto upload = uploads.find(from.at(i));
+
+		if (upload == uploads.end()) {
+			auto samples = make_shared<vector<short>>();
+
+			if (access(from.at(i).c_str(), R_OK) != 0) {
+				LOG_ERROR("could not send " << from.at(i) << " to simulated " << ips.at(i));
+
+				return false;
+			}
+
+			// Only WAVs are played, anything else (e.g. the capture encoder) plays as silence
+			if (from.at(i).size() > 4 && from.at(i).compare(from.at(i).size() - 4, 4, ".wav") == 0)
+				WavReader::read(from.at(i), *samples);
+
+			upload = uploads.insert({ from.at(i), samples }).first;
+		}
+
+		lock_guard<mutex> guard(mutex_);
+		files_[{ ips.at(i), path }] = upload->second;
+	}
+
+	return true;
+}
+
+bool SimulatedDevices::transferLocal(const vector<string>& ips, const vector<string>& from, const vector<string>& to, bool overwrite) {
+	for (size_t i = 0; i < ips.size(); i++) {
+		auto path = getRemotePath(from.at(i), to.at(i));
+		vector<short> samples;
+
+		if (!overwrite && access(path.c_str(), F_OK) == 0)
+			continue;
+
+		{
+			lock_guard<mutex> guard(mutex_);
+			auto recording = recordings_.find({ ips.at(i), from.at(i) });
+
+			if (recording == recordings_.end()) {
+				LOG_ERROR("simulated " << ips.at(i) << " has not recorded " << from.at(i));
+
+				return false;
+			}
+
+			samples = recording->second;
+		}
+
+		WavReader::write(path, samples);
+	}
+
+	return true;
+}
+
+bool SimulatedDevices::isOnline(const string&) {
+	return true;
+}
+
+// Never reboots
+unsigned int SimulatedDevices::getEpoch(const string&) {
+	return 1;
+}
+
+bool SimulatedDevices::hasFile(const string& ip, const string& path, const FileChecksum& checksum) {
+	lock_guard<mutex> guard(mutex_);
+	auto iterator = checksums_.find({ ip, path });
+
+	return iterator != checksums_.end() && iterator->second == checksum && files_.count({ ip, path });
+}
+
+void SimulatedDevices::setFile(const string& ip, const string& path, const FileChecksum& checksum, unsigned int) {
+	lock_guard<mutex> guard(mutex_);
+
+	checksums_[{ ip, path }] = checksum;
+}
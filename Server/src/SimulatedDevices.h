@@ -0,0 +1,89 @@
+#pragma once
+#ifndef SIMULATED_DEVICES_H
+#define SIMULATED_DEVICES_H
+
+#include "DeviceBackend.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <memory>
+#include <mutex>
+
+/*
+	Speakers simulated in-process instead of reached over SSH, so the calibration can be timed
+	and tested on one machine, see device_backend in config. Scripts are interpreted rather than
+	run: sleep, aplay, arecord and wait move along a timeline per speaker starting when the
+	command is sent, dspd -e sets the EQ the speaker plays through (applied with FilterBank) and
+	dspd -w resets it. Anything else (amixer, systemctl, ...) succeeds without doing anything.
+
+	A recording is every playback of the same command convolved with the room impulse response
+	from the player to the microphone, plus noise at simulated_noise_level. The room is synthetic
+	unless simulated_impulse_responses has measured ones: the speakers stand at fixed random
+	places in a room of simulated_room_size with a diffuse tail decaying in simulated_rt60.
+	Commands return as soon as the recordings are computed unless simulated_realtime is set.
+*/
+class SimulatedDevices : public DeviceBackend {
+public:
+	std::vector<bool> connect(const std::vector<std::string>& ips) override;
+
+	SSHOutput command(const std::vector<std::string>& ips, const std::vector<std::string>& commands) override;
+	bool transferRemote(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) override;
+	bool transferLocal(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite) override;
+
+	bool isOnline(const std::string& ip) override;
+	unsigned int getEpoch(const std::string& ip) override;
+
+	bool hasFile(const std::string& ip, const std::string& path, const FileChecksum& checksum) override;
+	void setFile(const std::string& ip, const std::string& path, const FileChecksum& checksum, unsigned int epoch) override;
+
+private:
+	using Signal = std::shared_ptr<const std::vector<short>>;
+
+	// As set with dspd -e, no bands is flat
+	struct Equalizer {
+		std::vector<int> frequencies_;
+		std::vector<double> gains_;
+		double q_ = 1;
+	};
+
+	// Seconds from when the command was sent
+	struct Playback {
+		std::string ip_;
+		double start_;
+		Signal signal_;
+		Equalizer eq_;
+	};
+
+	struct Recording {
+		std::string ip_;
+		std::string path_;
+		double start_;
+		size_t samples_;
+	};
+
+	// Adds what the script plays and records, returns when it's done. Called with mutex_ held
+	double interpret(const std::string& ip, const std::string& script, std::vector<Playback>& playbacks, std::vector<Recording>& recordings);
+
+	std::vector<double> play(const Playback& playback);
+	std::vector<short> record(const Recording& recording, const std::vector<Playback>& playbacks, const std::vector<std::vector<double>>& played);
+
+	const std::vector<double>& getImpulseResponse(const std::string& speaker, const std::string& mic);
+	std::vector<double> createImpulseResponse(const std::string& speaker, const std::string& mic);
+	std::array<double, 3> getPosition(const std::string& ip);
+
+	std::mutex mutex_;
+	std::map<std::string, Equalizer> equalizers_;
+
+	// What was uploaded and recorded, by speaker and path on the speaker
+	std::map<std::pair<std::string, std::string>, Signal> files_;
+	std::map<std::pair<std::string, std::string>, FileChecksum> checksums_;
+	std::map<std::pair<std::string, std::string>, std::vector<short>> recordings_;
+
+	// The room doesn't change while the server runs, by speaker and microphone
+	std::map<std::pair<std::string, std::string>, std::vector<double>> impulse_responses_;
+	unsigned int recorded_ = 0;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "Sweep.h"
+#include "Base.h"
+#include "Config.h"
+
+#include <fftw3.h>
+
+#include <cmath>
+#include <climits>
+#include <complex>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+static size_t getFFTSize(size_t size) {
+	size_t fft_size = 1;
+
+	while (fft_size < size)
+		fft_size <<= 1;
+
+	return fft_size;
+}
+
+static vector<double> normalize(const vector<short>& samples) {
+	vector<double> normalized(samples.size());
+
+	for (size_t i = 0; i < samples.size(); i++)
+		normalized[i] = (double)samples[i] / (double)SHRT_MAX;
+
+	return normalized;
+}
+
+namespace nac {
+	// The FFTW planner is not thread safe, executing plans is
+	vector<complex<double>> forwardFFT(const vector<double>& input, size_t size) {
+		float* in = (float*)fftwf_malloc(sizeof(float) * size);
+		fftwf_complex* out = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (size / 2 + 1));
+		fftwf_plan plan;
+
+		#pragma omp critical(fftw_planner)
+		plan = fftwf_plan_dft_r2c_1d(size, in, out, FFTW_ESTIMATE);
+
+		for (size_t i = 0; i < size; i++)
+			in[i] = i < input.size() ? input[i] : 0;
+
+		fftwf_execute(plan);
+
+		vector<complex<double>> output(size / 2 + 1);
+
+		for (size_t i = 0; i < output.size(); i++)
+			output[i] = { out[i][0], out[i][1] };
+
+		#pragma omp critical(fftw_planner)
+		fftwf_destroy_plan(plan);
+
+		fftwf_free(in);
+		fftwf_free(out);
+
+		return output;
+	}
+
+	vector<double> inverseFFT(const vector<complex<double>>& input, size_t size) {
+		fftwf_complex* in = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (size / 2 + 1));
+		float* out = (float*)fftwf_malloc(sizeof(float) * size);
+		fftwf_plan plan;
+
+		#pragma omp critical(fftw_planner)
+		plan = fftwf_plan_dft_c2r_1d(size, in, out, FFTW_ESTIMATE);
+
+		for (size_t i = 0; i < size / 2 + 1; i++) {
+			in[i][0] = input[i].real();
+			in[i][1] = input[i].imag();
+		}
+
+		fftwf_execute(plan);
+
+		// FFTW does not normalize
+		vector<double> output(size);
+
+		for (size_t i = 0; i < size; i++)
+			output[i] = out[i] / size;
+
+		#pragma omp critical(fftw_planner)
+		fftwf_destroy_plan(plan);
+
+		fftwf_free(in);
+		fftwf_free(out);
+
+		return output;
+	}
+
+	double SweepSettings::getRate() const {
+		return duration_ / log(f_high_ / f_low_);
+	}
+
+	SweepSettings getSweepSettings() {
+		SweepSettings settings;
+		settings.f_low_ = Base::config().get<double>("sweep_f_low");
+		settings.f_high_ = Base::config().get<double>("sweep_f_high");
+		settings.duration_ = Base::config().get<double>("sweep_time");
+		settings.level_ = Base::config().get<double>("sweep_level");
+
+		return settings;
+	}
+
+	vector<short> createSweep(const SweepSettings& settings) {
+		size_t size = lround(settings.duration_ * settings.fs_);
+		size_t fade = settings.fs_ / 100;
+		double rate = settings.getRate();
+		double amplitude = pow(10, settings.level_ / 20) * SHRT_MAX;
+
+		vector<short> sweep(size);
+
+		for (size_t i = 0; i < size; i++) {
+			double t = (double)i / settings.fs_;
+			double value = sin(2 * PI * settings.f_low_ * rate * (exp(t / rate) - 1));
+
+			// Fade in and out to avoid clicks
+			if (i < fade)
+				value *= 0.5 * (1 - cos(PI * i / fade));
+			else if (i >= size - fade)
+				value *= 0.5 * (1 - cos(PI * (size - i - 1) / fade));
+
+			sweep[i] = lround(value * amplitude);
+		}
+
+		return sweep;
+	}
+
+	/*
+		Time reversed sweep with an envelope falling 6 dB per octave, which flattens the pink
+		spectrum of the sweep. Scaled so a capture identical to the sweep gives a unit impulse.
+	*/
+	vector<double> createInverseFilter(const vector<short>& sweep, const SweepSettings& settings) {
+		auto normalized = normalize(sweep);
+		double rate = settings.getRate();
+
+		vector<double> inverse(normalized.size());
+
+		for (size_t i = 0; i < normalized.size(); i++)
+			inverse[i] = normalized[normalized.size() - i - 1] * exp(-((double)i / settings.fs_) / rate);
+
+		// Use the median gain inside the sweep range, the edges are affected by the fades
+		size_t size = getFFTSize(normalized.size() * 2);
+		auto sweep_spectrum = forwardFFT(normalized, size);
+		auto inverse_spectrum = forwardFFT(inverse, size);
+
+		vector<double> gains;
+
+		for (size_t i = 0; i < sweep_spectrum.size(); i++) {
+			double frequency = (double)i * settings.fs_ / size;
+
+			if (frequency > settings.f_low_ * 2 && frequency < settings.f_high_ / 2)
+				gains.push_back(abs(sweep_spectrum[i] * inverse_spectrum[i]));
+		}
+
+		if (gains.empty()) {
+			cout << "Warning: sweep range is too narrow to normalize the inverse filter\n";
+
+			return inverse;
+		}
+
+		nth_element(gains.begin(), gains.begin() + gains.size() / 2, gains.end());
+		double gain = gains.at(gains.size() / 2);
+
+		for (auto& value : inverse)
+			value /= gain;
+
+		return inverse;
+	}
+
+	vector<double> convolve(const vector<double>& a, const vector<double>& b) {
+		if (a.empty() || b.empty())
+			return vector<double>();
+
+		size_t length = a.size() + b.size() - 1;
+		size_t size = getFFTSize(length);
+
+		auto a_spectrum = forwardFFT(a, size);
+		auto b_spectrum = forwardFFT(b, size);
+
+		for (size_t i = 0; i < a_spectrum.size(); i++)
+			a_spectrum[i] *= b_spectrum[i];
+
+		auto output = inverseFFT(a_spectrum, size);
+		output.resize(length);
+
+		return output;
+	}
+
+	vector<double> deconvolve(const vector<short>& capture, const vector<double>& inverse) {
+		return convolve(normalize(capture), inverse);
+	}
+
+	/*
+		Cuts out the impulse response of every sweep starting offsets samples into the capture.
+		The linear response of a sweep ends up sweep_length - 1 samples after its start, the peak
+		is searched for within search samples of that since the devices don't start in sync.
+	*/
+	vector<vector<double>> getImpulseResponses(const vector<double>& deconvolved, size_t sweep_length, const vector<size_t>& offsets, size_t search, size_t pre_delay, size_t length) {
+		vector<vector<double>> impulse_responses;
+
+		for (auto& offset : offsets) {
+			size_t expected = offset + sweep_length - 1;
+			size_t first = expected > search ? expected - search : 0;
+			size_t last = min(expected + search, deconvolved.size());
+
+			if (first >= last) {
+				cout << "Warning: sweep at " << offset << " is outside the capture\n";
+
+				impulse_responses.push_back(vector<double>(length, 0));
+				continue;
+			}
+
+			auto peak = max_element(deconvolved.begin() + first, deconvolved.begin() + last, [] (double a, double b) {
+				return abs(a) < abs(b);
+			});
+
+			size_t start = distance(deconvolved.begin(), peak);
+			start = start > pre_delay ? start - pre_delay : 0;
+
+			vector<double> impulse_response(length, 0);
+
+			for (size_t i = 0; i < length && start + i < deconvolved.size(); i++)
+				impulse_response[i] = deconvolved[start + i];
+
+			impulse_responses.push_back(impulse_response);
+		}
+
+		return impulse_responses;
+	}
+
+	// Half Hann windows at both ends, so the cut doesn't add ripple to the spectrum
+	void windowImpulseResponse(vector<double>& impulse_response, size_t fade_in, size_t fade_out) {
+		size_t size = impulse_response.size();
+
+		fade_in = min(fade_in, size);
+		fade_out = min(fade_out, size - fade_in);
+
+		for (size_t i = 0; i < fade_in; i++)
+			impulse_response[i] *= 0.5 * (1 - cos(PI * i / fade_in));
+
+		for (size_t i = 0; i < fade_out; i++)
+			impulse_response[size - i - 1] *= 0.5 * (1 - cos(PI * i / fade_out));
+	}
+
+	/*
+		Power spectrum of an impulse response. Divided by frequency to follow the pink noise
+		convention of doFFT(), which fitBands() and the EQ simulation expect.
+	*/
+	FFTOutput getResponseSpectrum(const vector<double>& impulse_response, int fs) {
+		auto spectrum = forwardFFT(impulse_response, RESPONSE_FFT_SIZE);
+
+		vector<double> frequencies(RESPONSE_FFT_SIZE / 2);
+		vector<double> energy(RESPONSE_FFT_SIZE / 2);
+
+		for (size_t i = 0; i < frequencies.size(); i++) {
+			frequencies[i] = (double)i * fs / RESPONSE_FFT_SIZE;
+			energy[i] = i == 0 ? 0 : norm(spectrum[i]) / frequencies[i];
+		}
+
+		return { frequencies, energy };
+	}
+
+	// The level a test signal would be recorded at, in dB relative to full scale
+	double getResponseLevel(const vector<double>& impulse_response, const vector<short>& signal) {
+		double signal_energy = 0;
+		double response_energy = 0;
+
+		for (auto& sample : normalize(signal))
+			signal_energy += sample * sample;
+
+		for (auto& sample : impulse_response)
+			response_energy += sample * sample;
+
+		return 10 * log10(signal_energy / signal.size()) + 10 * log10(response_energy);
+	}
+}
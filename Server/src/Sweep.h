@@ -0,0 +1,48 @@
+#pragma once
+#ifndef NAC_SWEEP_H
+#define NAC_SWEEP_H
+
+#include "Analyze.h"
+
+#include <vector>
+#include <complex>
+#include <cstddef>
+#include <cmath>
+
+// Exponential sine sweep measurements (Farina)
+namespace nac {
+	// Responses are returned with the same resolution as doFFT(), so band fitting sees the same bin density
+	const size_t RESPONSE_FFT_SIZE = 65536;
+
+	const double PI = std::atan(1) * 4;
+
+	struct SweepSettings {
+		double f_low_		= 20;
+		double f_high_		= 20000;
+		double duration_	= 10;
+		double level_		= -6;
+		int fs_				= 48000;
+
+		// Time for the instantaneous frequency to grow by e
+		double getRate() const;
+	};
+
+	SweepSettings getSweepSettings();
+
+	// Real FFTW transforms, also used by the other test signals
+	std::vector<std::complex<double>> forwardFFT(const std::vector<double>& input, size_t size);
+	std::vector<double> inverseFFT(const std::vector<std::complex<double>>& input, size_t size);
+
+	std::vector<short> createSweep(const SweepSettings& settings);
+	std::vector<double> createInverseFilter(const std::vector<short>& sweep, const SweepSettings& settings);
+
+	std::vector<double> convolve(const std::vector<double>& a, const std::vector<double>& b);
+	std::vector<double> deconvolve(const std::vector<short>& capture, const std::vector<double>& inverse);
+
+	std::vector<std::vector<double>> getImpulseResponses(const std::vector<double>& deconvolved, size_t sweep_length, const std::vector<size_t>& offsets, size_t search, size_t pre_delay, size_t length);
+	void windowImpulseResponse(std::vector<double>& impulse_response, size_t fade_in, size_t fade_out);
+	FFTOutput getResponseSpectrum(const std::vector<double>& impulse_response, int fs);
+	double getResponseLevel(const std::vector<double>& impulse_response, const std::vector<short>& signal);
+}
+
+#endif
@@ -2,82 +2,55 @@
 #include "Speaker.h"
 #include "Base.h"
 #include "Config.h"
-
-// libcurlpp
-#include <curlpp/cURLpp.hpp>
-#include <curlpp/Options.hpp>
-#include <curlpp/Easy.hpp>
+#include "Trace.h"
+#include "DeviceBackend.h"
+#include "CaptureCodec.h"
+#include "CaptureStream.h"
+#include "WavReader.h"
+#include "Log.h"
 
 #include <algorithm>
 #include <sstream>
+#include <fstream>
+#include <array>
+#include <map>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
 
 using namespace std;
 
-static void enableSSH(const string& ip) {
-	cURLpp::Cleanup clean;
-	string disable_string = "http://";
-	disable_string += ip;
-	disable_string += "/axis-cgi/admin/param.cgi?action=update&Network.SSH.Enabled=yes";
-	
-	cURLpp::Easy request;
-	ostringstream stream;
-	
-	request.setOpt(cURLpp::options::Url(disable_string.c_str())); 
-	request.setOpt(cURLpp::options::UserPwd(string("root:pass")));
-	request.setOpt(cURLpp::options::HttpAuth(CURLAUTH_ANY));
-	request.setOpt(cURLpp::options::WriteStream(&stream));
-	request.setOpt(cURLpp::options::Timeout(10));
+Speaker* System::findSpeaker(const string& ip) {
+	lock_guard<mutex> guard(speakers_mutex_);
+	auto iterator = speakers_.find(ip);
 	
-	try {
-		request.perform();
-	} catch (cURLpp::RuntimeError& exception) {
-		// GET request failed
-		cout << "Warning: request timed out in trying to set SSH enable\n";
-		cout << "Request: " << disable_string << endl;
-		cout << "cURLpp error: " << exception.what() << endl;
-		
-		return;
-	}
-	
-	if (stream.str() != "OK")
-		cout << "ERROR in enableSSH()\n";
+	return iterator == speakers_.end() ? nullptr : iterator->second.get();
 }
 
-Speaker& System::addSpeaker(Speaker& speaker) {
-	cout << "Using backup addSpeaker()\n";
-	cout << "Adding & connecting speaker " << speaker.getIP() << endl;
-	
-	if (!Base::config().get<bool>("enable_testing")) {
-		// Enable SSH
-		enableSSH(speaker.getIP());
+// Connecting is done without the lock, if another thread added the speaker meanwhile that one is kept
+Speaker& System::addSpeaker(const string& ip, bool online) {
+	unique_ptr<Speaker> speaker(new Speaker());
+	speaker->setIP(ip);
+	speaker->setOnline(online);
 	
-		// Open connection to Speaker if it's offline
-		speaker.setOnline(ssh_.connect(speaker.getIP(), "pass"));
-		
-		if (!speaker.isOnline())
-			cout << "Warning: speaker " << speaker.getIP() << " is not online\n";
-	} else {
-		// Set to online for testing
-		speaker.setOnline(true);
-	}
+	lock_guard<mutex> guard(speakers_mutex_);
 	
-	// Add speaker to list
-	speakers_.push_back(speaker);
-	
-	// Return reference to pushed back speaker
-	return speakers_.back();
+	return *speakers_.emplace(ip, move(speaker)).first->second;
 }
 
-// Batch check for connectivity
+// Batch check for connectivity, reconnects speakers the pool has found broken since
 bool System::checkConnection(const vector<string>& ips) {
 	auto speakers = getSpeakers(ips);
+	auto online = Base::devices().connect(ips);
 	
-	for (auto* speaker : speakers)
-		if (!speaker->isOnline())
-			return false;
+	for (size_t i = 0; i < speakers.size(); i++)
+		speakers.at(i)->setOnline(online.at(i));
 
-	return true;
+	return all_of(online.begin(), online.end(), [] (bool status) { return status; });
 }
 
 SSHOutput System::runScript(const vector<string>& ips, const vector<string>& scripts, bool temporary_connection) {
@@ -86,6 +59,8 @@ SSHOutput System::runScript(const vector<string>& ips, const vector<string>& scr
 		return System().runScript(ips, scripts);
 	}
 	
+	ScopedTimer timer("runScript", ips.size() == 1 ? ips.front() : "");
+	
 	// Make sure all speakers are connected
 	checkConnection(ips);
 	
@@ -96,9 +71,7 @@ SSHOutput System::runScript(const vector<string>& ips, const vector<string>& scr
 	
 	cout << "Running SSH commands... " << flush;
 	
-	ssh_.setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, true);
-	auto outputs = ssh_.command(ips, scripts);
-	ssh_.setSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE, false);
+	auto outputs = Base::devices().command(ips, scripts);
 	
 	// TODO: Add option to print outputs here
 	
@@ -114,32 +87,16 @@ vector<Speaker*> System::getSpeakers(const vector<string>& ips) {
 	vector<string> not_connected;
 	
 	for (auto& ip : ips) {
-		auto iterator = find(speakers_.begin(), speakers_.end(), ip);
-		
-		if (iterator == speakers_.end())
+		if (findSpeaker(ip) == nullptr && find(not_connected.begin(), not_connected.end(), ip) == not_connected.end())
 			not_connected.push_back(ip);
 	}
 	
-	if (!not_connected.empty()) {		
-		thread* enable_ssh_threads = new thread[not_connected.size()];
-		
-		for (size_t i = 0; i< not_connected.size(); i++)
-			enable_ssh_threads[i] = thread(enableSSH, ref(not_connected.at(i)));
-			
-		for (size_t i = 0; i < not_connected.size(); i++)
-			enable_ssh_threads[i].join();
-			
-		delete[] enable_ssh_threads;
-		
-		auto result = ssh_.connectResult(not_connected, "pass");
+	if (!not_connected.empty()) {
+		// Already connected if another session has used them
+		auto result = Base::devices().connect(not_connected);
 		
-		for (size_t i = 0; i < result.size(); i++) {
-			Speaker speaker;
-			speaker.setIP(not_connected.at(i));
-			speaker.setOnline(result.at(i));
-			
-			speakers_.push_back(speaker);
-		}
+		for (size_t i = 0; i < result.size(); i++)
+			addSpeaker(not_connected.at(i), result.at(i));
 	}
 	
 	vector<Speaker*> speakers;
@@ -151,24 +108,200 @@ vector<Speaker*> System::getSpeakers(const vector<string>& ips) {
 }
 
 Speaker& System::getSpeaker(const string& ip) {
-	auto iterator = find(speakers_.begin(), speakers_.end(), ip);
+	auto* speaker = findSpeaker(ip);
+	
+	if (speaker != nullptr)
+		return *speaker;
+		
+	cout << "Adding & connecting speaker " << ip << endl;
+	
+	// Always online for testing
+	if (Base::config().get<bool>("enable_testing"))
+		return addSpeaker(ip, true);
+		
+	return addSpeaker(ip, Base::devices().connect({ ip }).front());
+}
+
+// POSIX cksum, the speakers compute the same with cksum
+static bool getChecksum(const string& file, FileChecksum& checksum) {
+	static const auto table = [] () {
+		array<uint32_t, 256> values;
+		
+		for (uint32_t i = 0; i < values.size(); i++) {
+			uint32_t crc = i << 24;
+			
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+				
+			values[i] = crc;
+		}
+		
+		return values;
+	}();
+	
+	ifstream stream(file, ios::binary);
+	
+	if (!stream.is_open())
+		return false;
+		
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	vector<char> buffer(1 << 16);
+	
+	while (stream.read(buffer.data(), buffer.size()) || stream.gcount() > 0) {
+		for (streamsize i = 0; i < stream.gcount(); i++)
+			crc = (crc << 8) ^ table[(crc >> 24) ^ static_cast<unsigned char>(buffer[i])];
+			
+		size += stream.gcount();
+	}
+	
+	// Followed by the length, least significant byte first
+	for (auto length = size; length > 0; length >>= 8)
+		crc = (crc << 8) ^ table[(crc >> 24) ^ (length & 0xff)];
+		
+	checksum.crc_ = ~crc;
+	checksum.size_ = size;
+	
+	return true;
+}
+
+// Uploads always go to a directory
+static string getRemotePath(const string& from, const string& to) {
+	auto name = from.substr(from.find_last_of('/') + 1);
+	
+	return to.empty() || to.back() == '/' ? to + name : to + "/" + name;
+}
+
+/*
+	Indices of the uploads which aren't on the speakers already. Files sent in the current epoch
+	of a speaker are known, anything else is checked with cksum on the speaker since the files
+	can be there from before the server started.
+*/
+static vector<size_t> getOutdated(const vector<string>& ips, const vector<string>& from, const string& to, vector<FileChecksum>& checksums) {
+	auto& devices = Base::devices();
+	vector<size_t> outdated;
+	vector<size_t> unknown;
+	
+	checksums.assign(ips.size(), FileChecksum());
+	
+	for (size_t i = 0; i < ips.size(); i++) {
+		// Let the transfer report it
+		if (!getChecksum(from.at(i), checksums.at(i)))
+			outdated.push_back(i);
+		else if (!devices.hasFile(ips.at(i), getRemotePath(from.at(i), to), checksums.at(i)))
+			unknown.push_back(i);
+	}
+	
+	if (unknown.empty())
+		return outdated;
+		
+	vector<string> check_ips;
+	vector<string> scripts;
+	vector<unsigned int> epochs;
+	
+	for (auto i : unknown) {
+		check_ips.push_back(ips.at(i));
+		scripts.push_back("cksum " + getRemotePath(from.at(i), to) + " 2>/dev/null; wait\n");
+		epochs.push_back(devices.getEpoch(ips.at(i)));
+	}
+	
+	// Output lines are "crc size path", missing files print nothing
+	map<pair<string, string>, FileChecksum> remote;
+	
+	for (auto& output : devices.command(check_ips, scripts)) {
+		for (auto& line : output.second) {
+			istringstream stream(line);
+			FileChecksum checksum;
+			string path;
+			
+			if (stream >> checksum.crc_ >> checksum.size_ >> path)
+				remote[{ output.first, path }] = checksum;
+		}
+	}
+	
+	for (size_t j = 0; j < unknown.size(); j++) {
+		auto i = unknown.at(j);
+		auto path = getRemotePath(from.at(i), to);
+		auto iterator = remote.find({ ips.at(i), path });
+		
+		if (iterator != remote.end() && iterator->second == checksums.at(i))
+			devices.setFile(ips.at(i), path, checksums.at(i), epochs.at(j));
+		else
+			outdated.push_back(i);
+	}
+	
+	sort(outdated.begin(), outdated.end());
 	
-	if (iterator == speakers_.end()) {
-		Speaker speaker;
-		speaker.setIP(ip);
+	return outdated;
+}
+
+// Only sends what isn't on the speakers already if upload_cache is set, every speaker in parallel
+static bool send(const vector<string>& ips, const vector<string>& from, const string& to, bool overwrite, size_t& sent) {
+	auto& devices = Base::devices();
+	sent = ips.size();
+	
+	// Without overwrite the speakers keep what they have anyway
+	if (!overwrite || !Base::config().get<bool>("upload_cache"))
+		return devices.transferRemote(ips, from, vector<string>(ips.size(), to), overwrite);
+		
+	vector<FileChecksum> checksums;
+	auto outdated = getOutdated(ips, from, to, checksums);
+	sent = outdated.size();
+	
+	if (outdated.empty())
+		return true;
+		
+	vector<string> send_ips;
+	vector<string> send_from;
+	vector<unsigned int> epochs;
+	
+	for (auto i : outdated) {
+		send_ips.push_back(ips.at(i));
+		send_from.push_back(from.at(i));
+		
+		// From before sending, a reconnect while sending means the file is checked again next time
+		epochs.push_back(devices.getEpoch(ips.at(i)));
+	}
+	
+	if (!devices.transferRemote(send_ips, send_from, vector<string>(send_ips.size(), to), true))
+		return false;
+		
+	for (size_t j = 0; j < outdated.size(); j++) {
+		auto i = outdated.at(j);
 		
-		return addSpeaker(speaker);
-	} else {
-		return *iterator;
+		devices.setFile(ips.at(i), getRemotePath(from.at(i), to), checksums.at(i), epochs.at(j));
 	}
+	
+	return true;
 }
 
 bool System::sendFile(const vector<string>& ips, const string& from, const string& to, bool overwrite) {
+	ScopedTimer timer("sendFile");
 	checkConnection(ips);
 	
-	cout << "Sending file " << from << " -> " << to << "... " << flush;
-	auto status = ssh_.transferRemote(ips, vector<string>(ips.size(), from), vector<string>(ips.size(), to), overwrite);
-	cout << (status ? "done\n" : "ERROR\n");
+	size_t sent;
+	auto status = send(ips, vector<string>(ips.size(), from), to, overwrite, sent);
+	
+	if (status)
+		LOG_INFO("Sent file " << from << " -> " << to << " (" << ips.size() - sent << " of " << ips.size() << " up to date)");
+	else
+		LOG_ERROR("could not send file " << from << " -> " << to);
+	
+	return status;
+}
+
+// One file per IP, in the same order
+bool System::sendFiles(const vector<string>& ips, const vector<string>& from, const string& to, bool overwrite) {
+	ScopedTimer timer("sendFile");
+	checkConnection(ips);
+	
+	size_t sent;
+	auto status = send(ips, from, to, overwrite, sent);
+	
+	if (status)
+		LOG_INFO("Sent " << from.size() << " files -> " << to << " (" << ips.size() - sent << " of " << ips.size() << " up to date)");
+	else
+		LOG_ERROR("could not send " << from.size() << " files -> " << to);
 	
 	return status;
 }
@@ -181,22 +314,226 @@ bool System::getFile(const vector<string>& ips, const vector<string>& from, cons
 	}
 	
 	cout << "Retrieving files from SSH... " << flush;
-	auto status = ssh_.transferLocal(ips, from, to, true);
+	auto status = Base::devices().transferLocal(ips, from, to, true);
 	cout << (status ? "done\n" : "ERROR\n") << flush;
 	
 	return status;
 }
 
+// Archived recordings are hard links, a new recording must not write through them
+static void replaceRecording(const string& ip) {
+	string file = "results/cap" + ip + ".wav";
+	
+	if (unlink(file.c_str()) != 0 && errno != ENOENT)
+		cout << "Warning: could not remove old recording " << file << ": " << strerror(errno) << endl;
+}
+
+static string getEncoderPath() {
+	auto encoder = Base::config().get<string>("capture_encoder");
+	
+	return "/tmp/" + encoder.substr(encoder.find_last_of('/') + 1);
+}
+
+static string getRemoteRecording(const string& ip, bool compressed) {
+	return "/tmp/cap" + ip + (compressed ? ".nacp" : ".wav");
+}
+
+// The analysis reads WAVs, so compressed recordings are decoded to where the WAV would be
+static bool decodeRecording(const string& ip) {
+	string file = "results/cap" + ip + ".nacp";
+	vector<short> samples;
+	
+	bool status = CaptureCodec::decode(file, samples);
+	
+	if (status)
+		WavReader::write("results/cap" + ip + ".wav", samples);
+		
+	unlink(file.c_str());
+	
+	return status;
+}
+
+// Written like a fetched one, for the analysis and the archive
+static bool writeStreamedRecording(const string& ip) {
+	vector<short> samples;
+	
+	if (!Base::captures().get(ip, samples))
+		return false;
+		
+	replaceRecording(ip);
+	WavReader::write("results/cap" + ip + ".wav", samples);
+	
+	return true;
+}
+
+void System::prepareRecordings(const vector<string>& ips) {
+	recording_type_ = RECORDING_FILE;
+	
+	// Simulated speakers don't run nc or the encoder
+	if (Base::config().get<string>("device_backend") == "simulated")
+		return;
+		
+	if (Base::config().get<bool>("capture_streaming")) {
+		// The microphones connect to us
+		if (Base::config().get<string>("capture_stream_host").empty()) {
+			LOG_WARNING("capture_stream_host is not set, fetching recordings afterwards");
+		} else if (Base::captures().start(Base::config().get<int>("capture_stream_port"))) {
+			recording_type_ = RECORDING_STREAMED;
+			
+			return;
+		}
+	}
+	
+	if (!Base::config().get<bool>("capture_compression"))
+		return;
+		
+	// Built for the speakers with make tools
+	auto encoder = Base::config().get<string>("capture_encoder");
+	
+	if (access(encoder.c_str(), R_OK) != 0) {
+		LOG_WARNING("capture encoder " << encoder << " is missing, recording uncompressed");
+		
+		return;
+	}
+	
+	// Only sent once per connection, see sendFile()
+	if (sendFile(ips, encoder, "/tmp/"))
+		recording_type_ = RECORDING_COMPRESSED;
+	else
+		LOG_WARNING("could not send capture encoder, recording uncompressed");
+}
+
+bool System::isStreamingRecordings() const {
+	return recording_type_ == RECORDING_STREAMED;
+}
+
+string System::getRecordCommand(const string& ip, int seconds) const {
+	string record = "arecord -D audiosource -r 48000 -f S16_LE -c 1 -d " + to_string(seconds);
+	
+	if (recording_type_ == RECORDING_STREAMED) {
+		Base::captures().expect(ip, seconds * 48000);
+		
+		// The first line tells which microphone it is
+		return "(echo " + ip + "; " + record + " -t raw) | nc " + Base::config().get<string>("capture_stream_host") + " " + Base::config().get<string>("capture_stream_port");
+	}
+	
+	if (recording_type_ == RECORDING_FILE)
+		return record + " " + getRemoteRecording(ip, false);
+		
+	auto encoder = getEncoderPath();
+	
+	return "chmod +x " + encoder + "; " + record + " -t raw | " + encoder + " 48000 > " + getRemoteRecording(ip, true);
+}
+
 bool System::getRecordings(const vector<string>& ips) {
+	ScopedTimer timer("getRecordings");
+	
+	if (recording_type_ == RECORDING_STREAMED) {
+		bool status = true;
+		
+		for (auto& ip : ips)
+			status = writeStreamedRecording(ip) && status;
+			
+		return status;
+	}
+	
+	bool compressed = recording_type_ == RECORDING_COMPRESSED;
 	vector<string> from;
 	vector<string> to;
 	
 	for (auto& ip : ips) {
-		from.push_back("/tmp/cap" + ip + ".wav");
+		from.push_back(getRemoteRecording(ip, compressed));
 		to.push_back("results");
+		
+		replaceRecording(ip);
+	}
+	
+	auto status = getFile(ips, from, to);
+	
+	if (status && compressed) {
+		ScopedTimer decode_timer("decode recordings");
+		
+		for (auto& ip : ips)
+			status = decodeRecording(ip) && status;
 	}
 	
-	return getFile(ips, from, to);
+	return status;
+}
+
+/*
+	Fetches the recordings one by one in the background and calls on_ready with the index
+	of every recording as soon as it has arrived, so analysis overlaps the transfers.
+	on_ready runs on the calling thread, in arrival order.
+*/
+bool System::getRecordings(const vector<string>& ips, const function<void(size_t)>& on_ready) {
+	ScopedTimer timer("getRecordings");
+	auto& trace = Base::trace();
+	
+	// Connect up front, the transfer thread should not touch the speaker list
+	checkConnection(ips);
+	
+	mutex ready_mutex;
+	condition_variable ready_condition;
+	deque<size_t> ready;
+	bool status = true;
+	
+	auto* session = g_session;
+	
+	thread transfer([&] () {
+		// Streamed recordings wait as long as the session's config says
+		g_session = session;
+		
+		for (size_t i = 0; i < ips.size(); i++) {
+			ScopedTimer transfer_timer(trace, "transfer recording", "", ips.at(i));
+			bool transferred;
+			
+			if (recording_type_ == RECORDING_STREAMED) {
+				transferred = writeStreamedRecording(ips.at(i));
+			} else {
+				auto from = getRemoteRecording(ips.at(i), recording_type_ == RECORDING_COMPRESSED);
+				cout << "Retrieving (" << ips.at(i) << ") " << from << " -> results\n";
+				replaceRecording(ips.at(i));
+				
+				transferred = Base::devices().transferLocal({ ips.at(i) }, { from }, { "results" }, true);
+				
+				if (transferred && recording_type_ == RECORDING_COMPRESSED)
+					transferred = decodeRecording(ips.at(i));
+			}
+			
+			if (!transferred)
+				cout << "ERROR: could not retrieve recording from " << ips.at(i) << endl;
+			
+			lock_guard<mutex> guard(ready_mutex);
+			status = status && transferred;
+			ready.push_back(i);
+			ready_condition.notify_one();
+		}
+	});
+	
+	try {
+		for (size_t handled = 0; handled < ips.size(); handled++) {
+			size_t index;
+			
+			{
+				unique_lock<mutex> lock(ready_mutex);
+				ready_condition.wait(lock, [&ready] () { return !ready.empty(); });
+				
+				index = ready.front();
+				ready.pop_front();
+			}
+			
+			on_ready(index);
+		}
+	} catch (...) {
+		// E.g. a cancelled job, the transfers still have to finish before unwinding
+		transfer.join();
+		
+		throw;
+	}
+	
+	transfer.join();
+	
+	return status;
 }
 
 void System::setSpeakerProfile(const Profile& profile) {
@@ -6,20 +6,39 @@
 #include "Speaker.h"
 #include "Profile.h"
 
-// libnessh
-#include <libnessh/SSHMaster.h>
-
 #include <vector>
-// Contains SSH connections to all speakers and current speaker settings
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+// How the microphones record, see System::prepareRecordings()
+enum {
+	RECORDING_FILE,
+	RECORDING_COMPRESSED,
+	RECORDING_STREAMED
+};
+
+// Speakers and current speaker settings of a session, the connections are shared, see DeviceBackend
 class System {
 public:
 	SSHOutput runScript(const std::vector<std::string>& ips, const std::vector<std::string>& scripts, bool temporary_connection = false);
 	bool sendFile(const std::vector<std::string>& ips, const std::string& from, const std::string& to, bool overwrite = true);
+	bool sendFiles(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::string& to, bool overwrite = true);
 	bool getFile(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to);
 	
+	// Streams the recordings if capture_streaming is set, or else sends the capture encoder if capture_compression is.
+	// The record commands and getRecordings() follow it
+	void prepareRecordings(const std::vector<std::string>& ips);
+	bool isStreamingRecordings() const;
+	std::string getRecordCommand(const std::string& ip, int seconds) const;
+	
 	bool getRecordings(const std::vector<std::string>& ips);
+	bool getRecordings(const std::vector<std::string>& ips, const std::function<void(size_t)>& on_ready);
 	bool checkConnection(const std::vector<std::string>& ips);
 
+	// Connects speakers seen for the first time. Speakers are never moved or removed, so the
+	// references and pointers stay valid for as long as the System
 	Speaker& getSpeaker(const std::string& ip);
 	std::vector<Speaker*> getSpeakers(const std::vector<std::string>& ips);
 	
@@ -35,10 +54,15 @@ private:
 	Profile speaker_profile_;
 	Profile microphone_profile_;
 	
-	Speaker& addSpeaker(Speaker& speaker);
+	Speaker* findSpeaker(const std::string& ip);
+	Speaker& addSpeaker(const std::string& ip, bool online);
+	
+	// Looked up from OpenMP teams during analysis
+	std::unordered_map<std::string, std::unique_ptr<Speaker>> speakers_;
+	std::mutex speakers_mutex_;
 	
-	std::vector<Speaker> speakers_;
-	SSHMaster ssh_;
+	// Set by prepareRecordings()
+	int recording_type_ = RECORDING_FILE;
 };
 
 #endif
\ No newline at end of file
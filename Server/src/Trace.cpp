@@ -0,0 +1,186 @@
+#include "Trace.h"
+#include "Base.h"
+#include "Config.h"
+#include "Archive.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+// Small thread numbers read better than thread IDs in the trace viewer
+static atomic<int> g_next_thread(1);
+static thread_local int g_thread = 0;
+
+static int getThread() {
+	if (g_thread == 0)
+		g_thread = g_next_thread++;
+
+	return g_thread;
+}
+
+static string escape(const string& text) {
+	string escaped;
+
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+
+		escaped += c;
+	}
+
+	return escaped;
+}
+
+static double getMicroseconds(TraceClock::time_point from, TraceClock::time_point to) {
+	return chrono::duration<double, micro>(to - from).count();
+}
+
+void Trace::start(const string& run) {
+	lock_guard<mutex> guard(mutex_);
+
+	if (depth_++ > 0)
+		return;
+
+	events_.clear();
+	run_ = run;
+	origin_ = TraceClock::now();
+	recording_ = true;
+}
+
+void Trace::stop() {
+	string chrome_trace;
+	string summary;
+	string run;
+
+	{
+		lock_guard<mutex> guard(mutex_);
+
+		if (depth_ == 0 || --depth_ > 0)
+			return;
+
+		recording_ = false;
+		end_ = TraceClock::now();
+
+		chrome_trace = getChromeTrace();
+		summary = getSummary();
+		run = run_;
+	}
+
+	cout << summary;
+
+	auto folder = Base::config().get<string>("trace_folder");
+
+	Base::archive().addText(folder + "/" + run + ".json", chrome_trace);
+	Base::archive().addText(folder + "/" + run + ".txt", summary);
+}
+
+bool Trace::isRecording() const {
+	return recording_;
+}
+
+void Trace::add(const string& stage, const string& speaker, const string& mic, TraceClock::time_point start, TraceClock::time_point stop) {
+	int thread = getThread();
+	lock_guard<mutex> guard(mutex_);
+
+	// Started before the run was stopped
+	if (!recording_)
+		return;
+
+	events_.push_back({ stage, speaker, mic, start, stop, thread });
+}
+
+// Complete events, timestamps in microseconds since the start of the run
+string Trace::getChromeTrace() const {
+	ostringstream json;
+	json << fixed << setprecision(1);
+	json << "{\"traceEvents\":[";
+
+	for (size_t i = 0; i < events_.size(); i++) {
+		auto& event = events_.at(i);
+
+		json << (i == 0 ? "" : ",") << "\n{\"name\":\"" << escape(event.stage_) << "\",\"cat\":\"" << escape(run_) << "\",\"ph\":\"X\"";
+		json << ",\"ts\":" << getMicroseconds(origin_, event.start_) << ",\"dur\":" << getMicroseconds(event.start_, event.stop_);
+		json << ",\"pid\":1,\"tid\":" << event.thread_;
+		json << ",\"args\":{\"speaker\":\"" << escape(event.speaker_) << "\",\"mic\":\"" << escape(event.mic_) << "\"}}";
+	}
+
+	json << "\n]}\n";
+
+	return json.str();
+}
+
+/*
+	Stages overlap, e.g. doFFT inside findSimulatedEQSettings or the same stage on several
+	threads, so the share of the run can add up to more than 100 %.
+*/
+string Trace::getSummary() const {
+	struct Total {
+		size_t count_ = 0;
+		double total_ = 0;
+		double max_ = 0;
+	};
+
+	map<string, Total> totals;
+
+	for (auto& event : events_) {
+		double duration = getMicroseconds(event.start_, event.stop_) / 1000;
+		auto& total = totals[event.stage_];
+
+		total.count_++;
+		total.total_ += duration;
+		total.max_ = max(total.max_, duration);
+	}
+
+	vector<pair<string, Total>> sorted(totals.begin(), totals.end());
+	sort(sorted.begin(), sorted.end(), [] (auto& a, auto& b) { return a.second.total_ > b.second.total_; });
+
+	double wall = getMicroseconds(origin_, end_) / 1000;
+
+	ostringstream summary;
+	summary << fixed << setprecision(1);
+	summary << "Trace of " << run_ << ", " << wall / 1000 << " s\n";
+	summary << left << setw(32) << "stage" << right << setw(8) << "count" << setw(12) << "total ms" << setw(12) << "mean ms" << setw(12) << "max ms" << setw(8) << "%" << "\n";
+
+	for (auto& entry : sorted) {
+		auto& total = entry.second;
+
+		summary << left << setw(32) << entry.first << right << setw(8) << total.count_ << setw(12) << total.total_;
+		summary << setw(12) << total.total_ / total.count_ << setw(12) << total.max_ << setw(8) << (wall > 0 ? 100 * total.total_ / wall : 0) << "\n";
+	}
+
+	return summary.str();
+}
+
+TraceRun::TraceRun(const string& run) :
+	trace_(Base::trace()) {
+	trace_.start(run);
+}
+
+TraceRun::~TraceRun() {
+	trace_.stop();
+}
+
+ScopedTimer::ScopedTimer(const string& stage, const string& speaker, const string& mic) :
+	ScopedTimer(Base::trace(), stage, speaker, mic) {
+}
+
+ScopedTimer::ScopedTimer(Trace& trace, const string& stage, const string& speaker, const string& mic) :
+	trace_(trace),
+	recording_(trace.isRecording()) {
+	if (!recording_)
+		return;
+
+	stage_ = stage;
+	speaker_ = speaker;
+	mic_ = mic;
+	start_ = TraceClock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+	if (recording_)
+		trace_.add(stage_, speaker_, mic_, start_, TraceClock::now());
+}
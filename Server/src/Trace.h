@@ -0,0 +1,77 @@
+#pragma once
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using TraceClock = std::chrono::steady_clock;
+
+/*
+	Where the time of a calibration run goes. Stages are timed with ScopedTimer and only kept
+	while a run is traced, see TraceRun. At the end of the run a Chrome trace (chrome://tracing,
+	Perfetto) and a summary table per stage are written to trace_folder.
+*/
+class Trace {
+public:
+	// Runs nest, only the outermost one is saved
+	void start(const std::string& run);
+	void stop();
+
+	bool isRecording() const;
+	void add(const std::string& stage, const std::string& speaker, const std::string& mic, TraceClock::time_point start, TraceClock::time_point stop);
+
+private:
+	struct Event {
+		std::string stage_;
+		std::string speaker_;
+		std::string mic_;
+		TraceClock::time_point start_;
+		TraceClock::time_point stop_;
+		int thread_;
+	};
+
+	std::string getChromeTrace() const;
+	std::string getSummary() const;
+
+	std::mutex mutex_;
+	std::vector<Event> events_;
+	std::string run_;
+	TraceClock::time_point origin_;
+	TraceClock::time_point end_;
+	int depth_ = 0;
+	std::atomic<bool> recording_ { false };
+};
+
+// Traces the run of the current session until it goes out of scope, also when cancelled
+class TraceRun {
+public:
+	explicit TraceRun(const std::string& run);
+	~TraceRun();
+
+private:
+	Trace& trace_;
+};
+
+// Adds the time until it goes out of scope as a stage, nearly free when nothing is traced
+class ScopedTimer {
+public:
+	explicit ScopedTimer(const std::string& stage, const std::string& speaker = "", const std::string& mic = "");
+
+	// For threads without a session, e.g. pass Base::trace() from the thread starting them
+	ScopedTimer(Trace& trace, const std::string& stage, const std::string& speaker = "", const std::string& mic = "");
+	~ScopedTimer();
+
+private:
+	Trace& trace_;
+	bool recording_;
+	std::string stage_;
+	std::string speaker_;
+	std::string mic_;
+	TraceClock::time_point start_;
+};
+
+#endif
@@ -63,11 +63,14 @@ void WavReader::write(const string& filename, const vector<short>& input, const
 		
 		header_file.close();
 	} else {
-		cout << "Warning: not reading header from another WAV is not supported right now\n";
-		
-		throw exception();
+		// Same format as the recordings, 48 kHz 16-bit mono
+		header = { { 'R', 'I', 'F', 'F' }, 0, { 'W', 'A', 'V', 'E' }, { 'f', 'm', 't', ' ' }, 16, 1, 1, 48000, 48000 * 2, 2, 16, { 'd', 'a', 't', 'a' }, 0 };
 	}
 	
+	// Sizes should describe the new data
+	header.Subchunk2Size = input.size() * sizeof(short);
+	header.ChunkSize = header.Subchunk2Size + sizeof(WavHeader) - 8;
+	
 	// Write header
 	file.write((const char*)&header, sizeof(WavHeader));
 	cout << "Wrote WAV header (" << sizeof(WavHeader) << " bytes)\n";
@@ -0,0 +1,167 @@
+/*
+	Lossless encoder for recordings, runs on the speakers between arecord and the file:
+
+		arecord -D audiosource -r 48000 -f S16_LE -c 1 -t raw -d 10 | nacpack 48000 > cap.nacp
+
+	Reads 16-bit mono PCM from stdin. Every block of samples is predicted with the best of the
+	fixed polynomial predictors of order 0-2 (as in FLAC) and the residuals are Rice coded, which
+	takes 10-25 % off loud noise captures and much more off quiet parts. Blocks which wouldn't
+	get smaller are stored as they are. The server decodes it in CaptureCodec.cpp, the format
+	is described there. Plain C99 so it builds with whatever compiler the speakers have, see
+	make tools in the Makefile.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BLOCK_SIZE	4096
+#define MAX_ORDER	2
+#define VERBATIM	255
+#define MAX_K		20
+#define ESCAPE		24
+#define ESCAPE_BITS	24
+
+struct BitWriter {
+	unsigned char* data;
+	size_t size;
+	uint64_t bits;
+	int count;
+};
+
+static void putBits(struct BitWriter* writer, uint32_t value, int bits) {
+	writer->bits = (writer->bits << bits) | (value & ((1ULL << bits) - 1));
+	writer->count += bits;
+
+	while (writer->count >= 8) {
+		writer->count -= 8;
+		writer->data[writer->size++] = (unsigned char)(writer->bits >> writer->count);
+	}
+}
+
+static void flushBits(struct BitWriter* writer) {
+	if (writer->count > 0)
+		putBits(writer, 0, 8 - writer->count);
+}
+
+static void putLittleEndian(unsigned char* data, uint32_t value, int bytes) {
+	int i;
+
+	for (i = 0; i < bytes; i++)
+		data[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t zigzag(int32_t value) {
+	return value >= 0 ? (uint32_t)value << 1 : ((uint32_t)(-(value + 1)) << 1) | 1;
+}
+
+static int32_t predict(const int16_t* samples, size_t i, int order) {
+	switch (order) {
+		case 0: return 0;
+		case 1: return samples[i - 1];
+		default: return 2 * samples[i - 1] - samples[i - 2];
+	}
+}
+
+static void encodeBlock(const int16_t* samples, size_t count, FILE* out) {
+	/* Worst case is every residual escaped */
+	static unsigned char payload[BLOCK_SIZE * 7 + 16];
+	static uint32_t residuals[BLOCK_SIZE];
+	unsigned char header[8];
+	struct BitWriter writer = { payload, 0, 0, 0 };
+	uint64_t best_sum = UINT64_MAX;
+	uint64_t best_cost = UINT64_MAX;
+	int order = 0;
+	int best_k = 0;
+	int k;
+	size_t i;
+
+	/* The order with the smallest residuals, the first samples are stored as they are */
+	for (k = 0; k <= MAX_ORDER && (size_t)k <= count; k++) {
+		uint64_t sum = 0;
+
+		for (i = k; i < count; i++)
+			sum += zigzag(samples[i] - predict(samples, i, k));
+
+		if (sum < best_sum) {
+			best_sum = sum;
+			order = k;
+		}
+	}
+
+	for (i = order; i < count; i++)
+		residuals[i] = zigzag(samples[i] - predict(samples, i, order));
+
+	for (k = 0; k <= MAX_K; k++) {
+		uint64_t cost = 0;
+
+		for (i = order; i < count; i++) {
+			uint32_t quotient = residuals[i] >> k;
+
+			cost += quotient < ESCAPE ? quotient + 1 + k : ESCAPE + ESCAPE_BITS;
+		}
+
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_k = k;
+		}
+	}
+
+	if (best_cost + 16 * order >= 16 * count) {
+		order = VERBATIM;
+		best_k = 0;
+
+		for (i = 0; i < count; i++)
+			putBits(&writer, (uint16_t)samples[i], 16);
+	} else {
+		for (i = 0; i < (size_t)order; i++)
+			putBits(&writer, (uint16_t)samples[i], 16);
+
+		for (i = order; i < count; i++) {
+			uint32_t quotient = residuals[i] >> best_k;
+
+			if (quotient < ESCAPE) {
+				while (quotient-- > 0)
+					putBits(&writer, 1, 1);
+
+				putBits(&writer, 0, 1);
+				putBits(&writer, residuals[i], best_k);
+			} else {
+				putBits(&writer, (1u << ESCAPE) - 1, ESCAPE);
+				putBits(&writer, residuals[i], ESCAPE_BITS);
+			}
+		}
+	}
+
+	flushBits(&writer);
+
+	putLittleEndian(header, (uint32_t)count, 2);
+	header[2] = (unsigned char)order;
+	header[3] = (unsigned char)best_k;
+	putLittleEndian(header + 4, (uint32_t)writer.size, 4);
+
+	fwrite(header, 1, sizeof(header), out);
+	fwrite(payload, 1, writer.size, out);
+}
+
+int main(int argc, char** argv) {
+	static int16_t samples[BLOCK_SIZE];
+	unsigned char header[16];
+	uint32_t rate = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 48000;
+	size_t count;
+
+	memcpy(header, "NACP", 4);
+	header[4] = 1;
+	header[5] = 1;
+	putLittleEndian(header + 6, BLOCK_SIZE, 2);
+	putLittleEndian(header + 8, rate, 4);
+	putLittleEndian(header + 12, 0, 4);
+
+	fwrite(header, 1, sizeof(header), stdout);
+
+	/* Samples are little endian like the speakers, fread fills whole blocks until the end */
+	while ((count = fread(samples, sizeof(int16_t), BLOCK_SIZE, stdin)) > 0)
+		encodeBlock(samples, count, stdout);
+
+	return fflush(stdout) == 0 ? 0 : 1;
+}